@@ -10,6 +10,7 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
 typedef struct tlbsim_client_t {
@@ -19,7 +20,19 @@ typedef struct tlbsim_client_t {
     bool (*phys_cmpxchg)(struct tlbsim_client_t *self, uint64_t, uint64_t, uint64_t);
     // Routine to invalidate L0 TLB to maintain inclusive property.
     // Type 1 -> DTLB, 2 -> ITLB, 3 -> Both
+    // VPN 0 invalidates all pages, which is used when a superpage is evicted.
     void (*invalidate_l0)(struct tlbsim_client_t* self, int hartid, uint64_t vpn, int type);
+    // Optional. Map a physical page to host memory, so page walks can access PTEs directly instead
+    // of calling phys_load and phys_cmpxchg. Returns NULL if the page is not writable RAM (e.g.
+    // MMIO or ROM), in which case the callbacks above are used. Mappings are cached, so a returned
+    // pointer must stay valid for the lifetime of the simulator. PTEs are accessed in host byte
+    // order.
+    void* (*phys_map)(struct tlbsim_client_t* self, uint64_t ppn);
+    // Optional. Invalidate count pages of the L0 TLB at once, in the same way as invalidate_l0.
+    // Invalidations are queued and passed to the client before the simulator returns from an
+    // access or flush of the hart, so several evictions can be handled together.
+    void (*invalidate_l0_batch)(struct tlbsim_client_t* self, int hartid, const uint64_t* vpns,
+                                size_t count, int type);
 } tlbsim_client_t;
 
 // Provided by the client (user).
@@ -39,8 +52,11 @@ typedef struct {
 } tlbsim_req_t;
 
 typedef struct {
+    // PPN of the 4K page of the requested VPN.
     uint64_t ppn;
     uint64_t pte;
+    // Size of the page the translation belongs to: 0 -> 4K, 1 -> 2M, 2 -> 1G, 3 -> 512G. The
+    // translation applies to the whole naturally aligned page, so it can be cached as a large page.
     unsigned granularity: 2;
     // If this is 0, it means permission check failed
     unsigned perm: 1;
@@ -55,6 +71,10 @@ extern bool tlbsim_need_instret;
 extern bool tlbsim_need_minstret;
 
 tlbsim_resp_t tlbsim_access(tlbsim_req_t* req);
+// Translate count requests, and store their responses in resps. Consecutive requests of the same
+// hart and TLB are looked up together before any miss is filled, as if they were issued at once; a
+// request for the same page as an earlier one is translated after it.
+void tlbsim_access_batch(tlbsim_req_t* reqs, tlbsim_resp_t* resps, size_t count);
 void tlbsim_flush(int hartid, int asid, uint64_t vpn);
 
 // Reset counters. If print is true, the old value is printed out.
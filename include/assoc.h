@@ -9,98 +9,277 @@
 #ifndef TLBSIM_ASSOC_H
 #define TLBSIM_ASSOC_H
 
+#include <deque>
+#include <vector>
+
 #include "tlb.h"
 #include "stats.h"
 #include "dyn_array.h"
-#include "dyn_bitset.h"
+#include "flat_map.h"
+#include "lookup.h"
 
 namespace tlbsim {
 
-template<typename T>
+// Generations of the ASIDs of a TLB, for lazy invalidation of ASID and full flushes.
+// Each ASID of a realm with entries in the TLB has a context, and global entries of a realm share
+// one. An entry records the epoch of the TLB when it was inserted. A flush records a new epoch in
+// the flushed context, or in the realm for a full flush, so every entry inserted before becomes
+// stale without being visited. Stale entries are treated as invalid by lookups, and are removed
+// from a set before anything is inserted into it.
+// Live entries are counted per context, so the number of entries flushed is still known. A full
+// flush takes the counts of all contexts of the realm.
+class Generations {
+public:
+    struct context_t;
+
+    struct realm_t {
+        // Epoch of the last full flush.
+        std::atomic<uint64_t> flushed {0};
+        // Contexts of the realm. Protected by lock.
+        std::vector<context_t*> contexts;
+    };
+
+    struct context_t {
+        realm_t* realm;
+        // Epoch of the last ASID flush. Never set for global entries.
+        std::atomic<uint64_t> flushed {0};
+        // Live entries in the lower 32 bits, and the number of times they were taken by a flush in
+        // the upper 32 bits, so that a count racing with a flush fails and is retried.
+        std::atomic<uint64_t> live {0};
+    };
+
+private:
+    std::atomic<uint64_t> epoch {0};
+    // Protects the maps, and serialises flushes.
+    Spinlock lock;
+    std::deque<context_t> contexts;
+    std::deque<realm_t> realms;
+    FlatMap<context_t*> context_map;
+    FlatMap<realm_t*> realm_map;
+
+    // Last contexts used by each hart, for non-global and global entries.
+    struct alignas(CACHE_LINE_SIZE) recent_t {
+        int32_t keys[2] = {INVALID_KEY, INVALID_KEY};
+        context_t* contexts[2];
+    };
+    recent_t recent[MAX_HARTS];
+
+    // Bit 30 of asid_t is always 0, so this is never the key of a context.
+    static constexpr int32_t INVALID_KEY = 0x40000000;
+
+    // Global entries of a realm share the context with ASID 0 and the global bit.
+    static int32_t key(asid_t asid) noexcept {
+        return asid.global() ? (int32_t)asid & (int32_t)0xffff0000 : (int32_t)asid;
+    }
+
+    context_t* context_slow(int32_t key);
+    void count(context_t* context, uint64_t epoch, int32_t delta) noexcept;
+    static uint64_t take(context_t* context) noexcept;
+
+public:
+    uint64_t current() const noexcept { return epoch.load(std::memory_order_acquire); }
+
+    // Context of entries of asid, which is created if needed.
+    context_t* context(asid_t asid) {
+        int32_t k = key(asid);
+        auto& cache = recent[current_hart];
+        int global = asid.global();
+        if (cache.keys[global] == k) return cache.contexts[global];
+        auto context = context_slow(k);
+        cache.keys[global] = k;
+        cache.contexts[global] = context;
+        return context;
+    }
+
+    // Whether an entry of the context inserted at epoch has been flushed.
+    static bool stale(const context_t* context, uint64_t epoch) noexcept {
+        return epoch < context->flushed.load(std::memory_order_relaxed) ||
+            epoch < context->realm->flushed.load(std::memory_order_relaxed);
+    }
+
+    // Account for an entry of a context inserted at epoch that becomes live, and one that is no
+    // longer live because it is replaced, evicted or flushed by page. Entries which are already
+    // stale are not counted, as they have been taken by the flush.
+    void insert(context_t* context, uint64_t epoch) noexcept {
+        count(context, epoch, 1);
+    }
+
+    void remove(context_t* context, uint64_t epoch) noexcept {
+        count(context, epoch, -1);
+    }
+
+    // Flush all entries of an ASID, or of a realm if asid is global. Returns the number of entries
+    // flushed.
+    uint64_t flush(asid_t asid);
+};
+
+// A FIFO-replaced array of TLB entries. Tags (see vpn_tag, and packed ASID) are kept in separate
+// arrays from the rest of the entry so that lookups can be performed by SIMD kernels. Invalid ways
+// are marked by INVALID_VPN in the tag array.
+// Entries flushed by ASID or fully are only invalidated lazily, see Generations. Stale entries are
+// removed before each insertion, so ways are replaced in the same way as if they had been
+// invalidated by the flush.
+// If Ways is non-zero, the associativity is fixed at compile time. Otherwise it is determined at
+// runtime by the size passed to the constructor.
+template<int Ways = 0>
 struct FIFOCache {
-    DynArray<T> entries;
-    DynBitset valid;
+    SizedArray<uint64_t, Ways> vpns;
+    SizedArray<int32_t, Ways> asids;
+    SizedArray<tlb_entry_t, Ways> entries;
+    // Context of each entry, and the epoch when it was inserted.
+    SizedArray<Generations::context_t*, Ways> contexts;
+    SizedArray<uint64_t, Ways> epochs;
+    Generations* generations;
     int ptr = 0;
-    int insert_ptr = 0;
+    // Epoch when stale entries were last removed. If it is current, no entry is stale.
+    uint64_t swept = 0;
+
+    FIFOCache(int size, Generations* generations):
+        vpns(size, INVALID_VPN), asids(size, 0), entries(size), contexts(size), epochs(size),
+        generations{generations} {}
+
+    lookup_result_t lookup(asid_t asid, uint64_t tag) const {
+        if constexpr (Ways != 0 && Ways <= 16) {
+            return lookup_fixed<Ways>(vpns.data(), asids.data(), tag, asid);
+        } else {
+            return lookup_kernel(vpns.data(), asids.data(), entries.size(), tag, asid);
+        }
+    }
+
+    bool stale(int way) const {
+        return Generations::stale(contexts[way], epochs[way]);
+    }
 
-    FIFOCache(int size): entries(size), valid(size) {}
+    // This does not modify the cache, so it can be used by optimistic readers.
+    const tlb_entry_t* find(asid_t asid, uint64_t tag) const {
+        auto result = lookup(asid, tag);
+        if (result.hit == -1) return nullptr;
+        if (swept != generations->current() && stale(result.hit)) return nullptr;
+        return &entries[result.hit];
+    }
 
-    template<typename Matcher>
-    T* find(Matcher matcher) {
-        insert_ptr = -1;
+    // Remove stale entries. Returns the current epoch.
+    uint64_t sweep() {
+        uint64_t epoch = generations->current();
+        if (swept == epoch) return epoch;
         int associativity = entries.size();
         for (int i = 0; i < associativity; i++) {
-            if (!valid[i]) {
-                if (insert_ptr == -1) insert_ptr = i;
-                continue;
-            }
-            auto& entry = entries[i];
-            if (!matcher(entry)) continue;
-            insert_ptr = i;
-            return &entry;
-        }
-        if (insert_ptr == -1) {
-            insert_ptr = ptr;
+            if (vpns[i] != INVALID_VPN && stale(i)) vpns[i] = INVALID_VPN;
         }
-        return nullptr;
+        swept = epoch;
+        return epoch;
     }
 
+    // Insert an entry, replacing the existing entry for the same translation if there is one.
+    // Otherwise an invalid way is used, or the way pointed by the FIFO pointer is evicted.
+    // The evicter is called with each live entry replaced, and whether it is of the same
+    // translation. Returns true if an existing entry is replaced.
     template<typename Evicter>
-    T* insert(const T& insert, Evicter evicter) {
+    bool insert(const tlb_entry_t& insert, Evicter evicter) {
+        uint64_t epoch = sweep();
+        auto context = generations->context(insert.asid);
+        uint64_t tag = insert.tag();
+        auto result = lookup(insert.asid, tag);
+        int insert_ptr = result.hit != -1 ? result.hit : result.free != -1 ? result.free : ptr;
         if (ptr == insert_ptr) {
             int associativity = entries.size();
             ptr = ptr == associativity - 1 ? 0 : ptr + 1;
         }
 
         auto& entry = entries[insert_ptr];
-        if (valid[insert_ptr]) {
-            evicter(entry);
+        if (vpns[insert_ptr] != INVALID_VPN) {
+            evicter(entry, result.hit != -1);
+            if (contexts[insert_ptr] != context) {
+                generations->remove(contexts[insert_ptr], epochs[insert_ptr]);
+                generations->insert(context, epoch);
+            }
+        } else {
+            generations->insert(context, epoch);
         }
 
         entry = insert;
-        valid[insert_ptr] = true;
-        return &entry;
+        vpns[insert_ptr] = tag;
+        asids[insert_ptr] = insert.asid;
+        contexts[insert_ptr] = context;
+        epochs[insert_ptr] = epoch;
+        return result.hit != -1;
+    }
+
+    // Invalidate the live entry of a translation. Returns whether there is one.
+    bool erase(asid_t asid, uint64_t tag) {
+        auto result = lookup(asid, tag);
+        if (result.hit == -1 || asids[result.hit] != asid || stale(result.hit)) return false;
+        vpns[result.hit] = INVALID_VPN;
+        generations->remove(contexts[result.hit], epochs[result.hit]);
+        return true;
     }
 
+    // Invalidate live entries for which filter returns true.
     template<typename Filter>
     void filter(Filter filter) {
         int associativity = entries.size();
         for (int i = 0; i < associativity; i++) {
-            if (!valid[i]) continue;
+            if (vpns[i] == INVALID_VPN || stale(i)) continue;
             auto& entry = entries[i];
             if (!filter(entry)) continue;
-            valid[i] = false;
+            vpns[i] = INVALID_VPN;
+            generations->remove(contexts[i], epochs[i]);
         }
     }
 };
 
+// Entries evicted while a set is locked. They are passed to TLB::evict once the set is unlocked, as
+// evicting may access other levels.
+template<size_t N>
+struct victims_t {
+    size_t count = 0;
+    tlb_entry_t entries[N];
+    // Entries replaced by the same translation are not spilled.
+    bool spill[N];
+
+    void add(const tlb_entry_t& entry, bool spill) {
+        entries[count] = entry;
+        this->spill[count++] = spill;
+    }
+
+    void evict(TLB& tlb) {
+        for (size_t i = 0; i < count; i++) tlb.evict(entries[i], spill[i]);
+    }
+};
+
+template<int Ways = 0>
 struct FIFOSet {
-    FIFOCache<tlb_entry_t> cache;
-    FIFOSet(int size): cache(size) {}
+    FIFOCache<Ways> cache;
+    FIFOSet(int size, Generations* generations): cache(size, generations) {}
 
-    bool find(tlb_entry_t& search) {
-        auto ptr = cache.find([&](auto& entry) {
-            if (entry.vpn != search.vpn) return false;
-            if (!entry.asid.match(search.asid)) return false;
-            return true;
-        });
+    // Find the entry of a granularity that translates search.vpn.
+    bool find(tlb_entry_t& search, int granularity) const {
+        auto ptr = cache.find(search.asid, vpn_tag(search.vpn, granularity));
         if (!ptr) return false;
-        search = *ptr;
+        search.hit(*ptr);
         return true;
     }
 
-    void insert(const tlb_entry_t& insert, TLB& tlb) {
-        cache.insert(insert, [&](auto& entry) {
+    // Insert an entry, replacing the existing entry for the same translation if there is one.
+    // Entries evicted are added to victims if the TLB tracks them. Returns true if an existing
+    // entry is replaced.
+    template<size_t N>
+    bool insert(const tlb_entry_t& insert, TLB& tlb, victims_t<N>& victims) {
+        return cache.insert(insert, [&](auto& entry, bool replaced) {
             ++tlb.stats->evict;
-            if (tlb.hartid != -1) {
-                tlbsim_client.invalidate_l0(&tlbsim_client, tlb.hartid, entry.vpn, 3);
-            }
+            if (tlb.tracks_evictions()) victims.add(entry, !replaced);
         });
     }
 
+    // Remove the entry of a translation. Returns whether there is one.
+    bool remove(const tlb_entry_t& entry) {
+        return cache.erase(entry.asid, entry.tag());
+    }
+
+    // Flush entries of a page. ASID and full flushes are performed by Generations::flush.
     void flush(int asid, uint64_t vpn, uint64_t& num_flush) {
         cache.filter([&](auto& entry) {
-            if (vpn != 0 && entry.vpn != vpn) return false;
+            if (!entry.covers(vpn)) return false;
             if (!entry.asid.match_flush(asid)) return false;
             num_flush++;
             return true;
@@ -108,107 +287,315 @@ struct FIFOSet {
     }
 };
 
-template<typename Set = FIFOSet>
-class AssocTLB: public TLB {
+// Look up a set while holding its lock. If the lock supports optimistic reads, the lookup is
+// performed without writing to the lock and retried if it races with a writer.
+template<typename Lock, typename Set>
+inline bool locked_find(Lock& lock, const Set& set, tlb_entry_t& search, int granularity, tlb_stats_t* stats) {
+    unsigned spins = 0;
+    bool found;
+    if constexpr (Lock::optimistic_read) {
+        tlb_entry_t result;
+        while (true) {
+            result = search;
+            uint32_t seq = lock.read_begin(spins);
+            found = set.find(result, granularity);
+            if (!lock.read_retry(seq)) break;
+            spins++;
+        }
+        search = result;
+    } else {
+        spins = lock.lock();
+        found = set.find(search, granularity);
+        lock.unlock();
+    }
+    if (spins) {
+        ++stats->contend;
+        stats->spin += spins;
+    }
+    return found;
+}
+
+template<typename Lock, typename Set>
+inline bool locked_insert(Lock& lock, Set& set, const tlb_entry_t& insert, TLB& tlb) {
+    victims_t<1> victims;
+    unsigned spins = lock.lock();
+    bool found = set.insert(insert, tlb, victims);
+    lock.unlock();
+    if (spins) {
+        ++tlb.stats->contend;
+        tlb.stats->spin += spins;
+    }
+    victims.evict(tlb);
+    return found;
+}
+
+// Batched versions of locked_find and locked_insert, for the requests in group. The lock is only
+// acquired once for all of them.
+template<typename Lock, typename Set>
+inline void locked_find_group(
+    Lock& lock, const Set& set, tlb_entry_t* searches, bool* hits, const uint8_t* group, size_t size,
+    tlb_stats_t* stats
+) {
+    unsigned spins = 0;
+    if constexpr (Lock::optimistic_read) {
+        tlb_entry_t results[MAX_BATCH];
+        bool found[MAX_BATCH];
+        while (true) {
+            uint32_t seq = lock.read_begin(spins);
+            for (size_t k = 0; k < size; k++) {
+                results[k] = searches[group[k]];
+                found[k] = set.find(results[k], 0);
+            }
+            if (!lock.read_retry(seq)) break;
+            spins++;
+        }
+        for (size_t k = 0; k < size; k++) {
+            searches[group[k]] = results[k];
+            hits[group[k]] = found[k];
+        }
+    } else {
+        spins = lock.lock();
+        for (size_t k = 0; k < size; k++) {
+            hits[group[k]] = set.find(searches[group[k]], 0);
+        }
+        lock.unlock();
+    }
+    if (spins) {
+        ++stats->contend;
+        stats->spin += spins;
+    }
+}
+
+template<typename Lock, typename Set>
+inline void locked_insert_group(
+    Lock& lock, Set& set, const tlb_entry_t* const* inserts, bool* replaced, const uint8_t* group,
+    size_t size, TLB& tlb
+) {
+    victims_t<MAX_BATCH> victims;
+    unsigned spins = lock.lock();
+    for (size_t k = 0; k < size; k++) {
+        replaced[group[k]] = set.insert(*inserts[group[k]], tlb, victims);
+    }
+    lock.unlock();
+    if (spins) {
+        ++tlb.stats->contend;
+        tlb.stats->spin += spins;
+    }
+    victims.evict(tlb);
+}
+
+template<typename Set = FIFOSet<>, typename Lock = Spinlock>
+class AssocTLB: public TLBImpl<AssocTLB<Set, Lock>> {
 private:
+    Generations generations;
     Set set;
-    Spinlock lock;
+    Lock lock;
+    granularity_set_t granularities;
 public:
-    AssocTLB(TLB* parent, tlb_stats_t* stats, int hartid, int size): TLB(parent, stats, hartid), set(size) {}
-    bool find_and_lock(tlb_entry_t& search) override {
-        lock.lock();
-        return set.find(search);
+    AssocTLB(TLB* parent, tlb_stats_t* stats, int hartid, int size):
+        TLBImpl<AssocTLB>(parent, stats, hartid), set(size, &generations) {}
+
+    bool find(tlb_entry_t& search) override final {
+        return granularities.any([&](int granularity) {
+            return locked_find(lock, set, search, granularity, this->stats);
+        });
     }
 
-    void unlock(const tlb_entry_t&) override {
-        lock.unlock();
+    bool insert(const tlb_entry_t& insert) override final {
+        granularities.add(insert.granularity);
+        return locked_insert(lock, set, insert, *this);
     }
 
-    void insert_and_unlock(const tlb_entry_t& insert) override {
-        set.insert(insert, *this);
+    void find_batch(tlb_entry_t* searches, bool* hits, size_t count) {
+        uint8_t group[MAX_BATCH];
+        for (size_t i = 0; i < count; i++) group[i] = i;
+        locked_find_group(lock, set, searches, hits, group, count, this->stats);
+        for (size_t i = 0; i < count; i++) {
+            if (hits[i]) continue;
+            hits[i] = granularities.any_superpage([&](int granularity) {
+                return locked_find(lock, set, searches[i], granularity, this->stats);
+            });
+        }
+    }
+
+    void insert_batch(const tlb_entry_t* const* inserts, bool* replaced, size_t count) {
+        uint8_t group[MAX_BATCH];
+        for (size_t i = 0; i < count; i++) {
+            granularities.add(inserts[i]->granularity);
+            group[i] = i;
+        }
+        locked_insert_group(lock, set, inserts, replaced, group, count, *this);
+    }
+
+    bool remove(const tlb_entry_t& entry) override final {
+        lock.lock();
+        bool found = set.remove(entry);
         lock.unlock();
+        return found;
+    }
+
+    void back_invalidate(const tlb_entry_t& entry) override {
+        if (remove(entry)) this->evict(entry, false);
     }
 
     void flush_local(asid_t asid, uint64_t vpn) override {
-        lock.lock();
         uint64_t num_flush = 0;
-        set.flush(asid, vpn, num_flush);
-        lock.unlock();
-        stats->flush += num_flush;
+        if (vpn == 0) {
+            num_flush = generations.flush(asid);
+        } else {
+            lock.lock();
+            set.flush(asid, vpn, num_flush);
+            lock.unlock();
+        }
+        this->stats->flush += num_flush;
     }
 };
 
-template<typename Set = FIFOSet>
-class SetAssocTLB: public TLB {
+// Index of the set a translation belongs to, in a TLB with 2^idx_bits sets.
+inline size_t set_index(asid_t asid, uint64_t vpn, int idx_bits) {
+    // Due to the existence of global pages, we either need to treat them differently, or
+    // we cannot use ASID bits in set index. As we mostly use an associativity of 8, and we
+    // usually have no more than 8 cores, this choice shouldn't be too bad.
+    // Of course a separate global/non-global page TLB can be easily implemented with our
+    // framework.
+
+    // We would like to also include realm id in calculation.
+    // We assume bits of realm id are equally important and least significant bits are used
+    // first.
+    if (idx_bits == 0) return 0;
+    size_t realm = bswap32(asid.realm()) >> (32 - idx_bits);
+    return (vpn & ((1 << idx_bits) - 1)) ^ realm;
+}
+
+// If Sets is non-zero, the number of sets is fixed at compile time. Otherwise it is determined at
+// runtime from the size and associativity passed to the constructor.
+// If Padded is true, each set is aligned to cache lines so that locks of neighbouring sets do not
+// share a cache line.
+template<typename Set = FIFOSet<>, int Sets = 0, typename Lock = Spinlock, bool Padded = false>
+class SetAssocTLB: public TLBImpl<SetAssocTLB<Set, Sets, Lock, Padded>> {
 private:
-    struct set_t {
+    struct alignas(Padded ? CACHE_LINE_SIZE : alignof(Set)) set_t {
         Set set;
-        Spinlock lock;
+        Lock lock;
 
-        set_t(int size): set(size) {}
+        set_t(int size, Generations* generations): set(size, generations) {}
         set_t(const set_t& other): set(other.set) {}
     };
+    Generations generations;
     DynArray<set_t> maps;
-    int idx_bits;
+    int _idx_bits;
+    granularity_set_t granularities;
 private:
-    inline size_t index(asid_t asid, uint64_t vpn) const {
-        // Due to the existence of global pages, we either need to treat them differently, or
-        // we cannot use ASID bits in set index. As we mostly use an associativity of 8, and we
-        // usually have no more than 8 cores, this choice shouldn't be too bad.
-        // Of course a separate global/non-global page TLB can be easily implemented with our
-        // framework.
+    inline int idx_bits() const {
+        if constexpr (Sets != 0) {
+            return ilog2(Sets);
+        } else {
+            return _idx_bits;
+        }
+    }
 
-        // We would like to also include realm id in calculation.
-        // We assume bits of realm id are equally important and least significant bits are used
-        // first.
-        size_t realm = bswap32(asid.realm()) >> (32 - idx_bits);
-        size_t set_index = (vpn & ((1 << idx_bits) - 1)) ^ realm;
-        return set_index;
+    // Superpages are indexed by their page number, so consecutive superpages are spread over sets.
+    inline size_t index(asid_t asid, uint64_t vpn, int granularity) const {
+        return set_index(asid, vpn >> (granularity * 9), idx_bits());
+    }
+
+    // Call f with each group of requests in the same set, where sets gives the set of each request.
+    // Requests within a group keep their order. Batches are small, so groups are found by
+    // comparing each request with the later ones, which is cheaper than sorting.
+    template<typename F>
+    static void for_each_set(const size_t* sets, size_t count, F f) {
+        bool grouped[MAX_BATCH] = {};
+        uint8_t group[MAX_BATCH];
+        for (size_t i = 0; i < count; i++) {
+            if (grouped[i]) continue;
+            size_t size = 0;
+            group[size++] = i;
+            for (size_t j = i + 1; j < count; j++) {
+                if (sets[j] != sets[i] || grouped[j]) continue;
+                grouped[j] = true;
+                group[size++] = j;
+            }
+            f(group, size);
+        }
     }
 
 public:
     SetAssocTLB(TLB* parent, tlb_stats_t* stats, int hartid, size_t size, int associativity):
-        TLB(parent, stats, hartid), maps(size / associativity, set_t(associativity)) {
+        TLBImpl<SetAssocTLB>(parent, stats, hartid), maps(size / associativity, set_t(associativity, &generations)) {
 
-        idx_bits = ilog2(size / associativity);
+        _idx_bits = ilog2(size / associativity);
     }
 
-    bool find_and_lock(tlb_entry_t& search) override {
-        size_t set_index = index(search.asid, search.vpn);
-        auto& set = maps[set_index];
-        set.lock.lock();
-        return set.set.find(search);
+    bool find(tlb_entry_t& search) override final {
+        return granularities.any([&](int granularity) {
+            auto& set = maps[index(search.asid, search.vpn, granularity)];
+            return locked_find(set.lock, set.set, search, granularity, this->stats);
+        });
     }
 
-    void unlock(const tlb_entry_t& entry) override {
-        size_t set_index = index(entry.asid, entry.vpn);
-        auto& set = maps[set_index];
-        set.lock.unlock();
+    bool insert(const tlb_entry_t& insert) override final {
+        granularities.add(insert.granularity);
+        auto& set = maps[index(insert.asid, insert.vpn, insert.granularity)];
+        return locked_insert(set.lock, set.set, insert, *this);
+    }
+
+    // Requests are grouped by set, so each set is locked once.
+    void find_batch(tlb_entry_t* searches, bool* hits, size_t count) {
+        size_t sets[MAX_BATCH];
+        for (size_t i = 0; i < count; i++) sets[i] = index(searches[i].asid, searches[i].vpn, 0);
+        for_each_set(sets, count, [&](const uint8_t* group, size_t size) {
+            auto& set = maps[sets[group[0]]];
+            locked_find_group(set.lock, set.set, searches, hits, group, size, this->stats);
+        });
+        for (size_t i = 0; i < count; i++) {
+            if (hits[i]) continue;
+            hits[i] = granularities.any_superpage([&](int granularity) {
+                auto& set = maps[index(searches[i].asid, searches[i].vpn, granularity)];
+                return locked_find(set.lock, set.set, searches[i], granularity, this->stats);
+            });
+        }
     }
 
-    void insert_and_unlock(const tlb_entry_t& insert) override {
-        size_t set_index = index(insert.asid, insert.vpn);
-        auto& set = maps[set_index];
-        set.set.insert(insert, *this);
+    void insert_batch(const tlb_entry_t* const* inserts, bool* replaced, size_t count) {
+        size_t sets[MAX_BATCH];
+        for (size_t i = 0; i < count; i++) {
+            auto& insert = *inserts[i];
+            granularities.add(insert.granularity);
+            sets[i] = index(insert.asid, insert.vpn, insert.granularity);
+        }
+        for_each_set(sets, count, [&](const uint8_t* group, size_t size) {
+            auto& set = maps[sets[group[0]]];
+            locked_insert_group(set.lock, set.set, inserts, replaced, group, size, *this);
+        });
+    }
+
+    bool remove(const tlb_entry_t& entry) override final {
+        auto& set = maps[index(entry.asid, entry.vpn, entry.granularity)];
+        set.lock.lock();
+        bool found = set.set.remove(entry);
         set.lock.unlock();
+        return found;
+    }
+
+    void back_invalidate(const tlb_entry_t& entry) override {
+        if (remove(entry)) this->evict(entry, false);
     }
 
     void flush_local(asid_t asid, uint64_t vpn) override {
         uint64_t num_flush = 0;
         if (vpn == 0) {
-            for (auto& set: maps) {
+            num_flush = generations.flush(asid);
+        } else {
+            // Entries of all granularities covering the page are flushed.
+            granularities.any([&](int granularity) {
+                auto& set = maps[index(asid, vpn, granularity)];
                 set.lock.lock();
-                set.set.flush(asid, 0, num_flush);
+                set.set.flush(asid, vpn, num_flush);
                 set.lock.unlock();
-            }
-        } else {
-            size_t set_index = index(asid, vpn);
-            auto& set = maps[set_index];
-            set.lock.lock();
-            set.set.flush(asid, vpn, num_flush);
-            set.lock.unlock();
+                return false;
+            });
         }
-        stats->flush += num_flush;
+        this->stats->flush += num_flush;
     }
 };
 
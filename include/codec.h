@@ -0,0 +1,32 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ * Copyright (c) 2019, Gary Guo
+ *
+ * This header provides a small LZ77 codec used to compress trace blocks. It favours speed over
+ * ratio, and has no external dependency.
+ */
+
+#ifndef TLBSIM_CODEC_H
+#define TLBSIM_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace tlbsim {
+
+// Maximum compressed size of an input of given size.
+static constexpr size_t lz_bound(size_t size) {
+    return size + size / 255 + 16;
+}
+
+// Compress size bytes from src to dst, which must have space for lz_bound(size) bytes. Returns the
+// compressed size.
+size_t lz_compress(const uint8_t* src, size_t size, uint8_t* dst);
+
+// Decompress size bytes from src to dst, which has space for exactly raw_size bytes. Returns false
+// if the input is malformed or does not decompress to exactly raw_size bytes.
+bool lz_decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t raw_size);
+
+}
+
+#endif // TLBSIM_CODEC_H
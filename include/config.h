@@ -10,11 +10,15 @@ namespace tlbsim {
 
 class TLB;
 class LogReplayer;
+class Sampler;
 
 //
 // Global configurations
 //
 
+// Maximum number of harts supported.
+static constexpr int MAX_HARTS = 32;
+
 // Whether invalidate entries should be cached.
 extern bool config_cache_inv;
 
@@ -23,11 +27,14 @@ extern bool config_update_pte;
 
 // Globally shared TLBs
 extern TLB* config_stlb;
-extern TLB* config_ctlbs[32];
-extern TLB* config_itlbs[32];
-extern TLB* config_dtlbs[32];
+extern TLB* config_ctlbs[MAX_HARTS];
+extern TLB* config_itlbs[MAX_HARTS];
+extern TLB* config_dtlbs[MAX_HARTS];
 extern LogReplayer* config_replayer;
 
+// Interval sampler of counters. nullptr if sampling is disabled.
+extern Sampler* config_sampler;
+
 void setup_private_tlb(int hartid);
 
 }
@@ -9,9 +9,11 @@
 #ifndef TLBSIM_DYN_ARRAY_H
 #define TLBSIM_DYN_ARRAY_H
 
+#include <array>
 #include <memory>
 #include <initializer_list>
 #include <iterator>
+#include <type_traits>
 
 namespace tlbsim {
 
@@ -123,6 +125,22 @@ public:
     size_type max_size() const { return _size; }
 };
 
+// Array with size fixed at compile time, but constructible like a DynArray. The count passed to
+// constructors must match N.
+template<typename T, size_t N>
+class FixedArray: public std::array<T, N> {
+public:
+    explicit FixedArray(size_t count) {}
+
+    explicit FixedArray(size_t count, const T& value) {
+        this->fill(value);
+    }
+};
+
+// Select FixedArray if N is known at compile time, or DynArray if N is 0.
+template<typename T, size_t N>
+using SizedArray = std::conditional_t<N == 0, DynArray<T>, FixedArray<T, N>>;
+
 }
 
 #endif // TLBSIM_DYN_ARRAY_H
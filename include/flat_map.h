@@ -0,0 +1,173 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ * Copyright (c) 2019, Gary Guo
+ *
+ * This header defines an open-addressing hash map with integer keys. Keys and values are stored
+ * inline in a single contiguous array, and collisions are resolved with Robin Hood hashing and
+ * backward-shift deletion, so no tombstones are needed.
+ */
+
+#ifndef TLBSIM_FLAT_MAP_H
+#define TLBSIM_FLAT_MAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace tlbsim {
+
+// Fold a key into 64 bits for hashing.
+static inline uint64_t flat_map_fold(uint64_t key) noexcept {
+    return key;
+}
+
+static inline uint64_t flat_map_fold(unsigned __int128 key) noexcept {
+    return (uint64_t)key ^ (uint64_t)(key >> 64) * 0xc2b2ae3d27d4eb4fULL;
+}
+
+template<typename V, typename K = uint64_t>
+class FlatMap {
+private:
+    struct slot_t {
+        K key;
+        // Distance from the home slot plus one. 0 means the slot is empty.
+        uint32_t dist;
+        V value;
+    };
+
+    std::vector<slot_t> slots;
+    size_t mask;
+    size_t count = 0;
+    int shift;
+
+public:
+    explicit FlatMap(size_t capacity = 16) {
+        // Capacity must be a power of two.
+        size_t cap = 16;
+        while (cap < capacity) cap <<= 1;
+        reset(cap);
+    }
+
+private:
+    void reset(size_t capacity) {
+        slots.assign(capacity, slot_t{});
+        mask = capacity - 1;
+        shift = 64 - __builtin_ctzll(capacity);
+    }
+
+    size_t home(K key) const noexcept {
+        // Fibonacci hashing. The high bits of the product depend on all bits of the key.
+        return (flat_map_fold(key) * 0x9e3779b97f4a7c15ULL) >> shift;
+    }
+
+    // Place an entry which is known to be absent. Returns the slot it is placed in.
+    size_t place(slot_t incoming) noexcept {
+        size_t i = home(incoming.key);
+        size_t placed = -1;
+        incoming.dist = 1;
+        while (true) {
+            auto& slot = slots[i];
+            if (slot.dist == 0) {
+                slot = std::move(incoming);
+                return placed == (size_t)-1 ? i : placed;
+            }
+            if (slot.dist < incoming.dist) {
+                std::swap(slot, incoming);
+                if (placed == (size_t)-1) placed = i;
+            }
+            i = (i + 1) & mask;
+            incoming.dist++;
+        }
+    }
+
+    void grow() {
+        std::vector<slot_t> old;
+        old.swap(slots);
+        reset(old.size() * 2);
+        for (auto& slot: old) {
+            if (slot.dist) place(std::move(slot));
+        }
+    }
+
+    size_t find_slot(K key) const noexcept {
+        size_t i = home(key);
+        for (uint32_t dist = 1; ; dist++) {
+            auto& slot = slots[i];
+            // Robin Hood invariant: the key would have displaced this entry if it were present.
+            if (slot.dist < dist) return -1;
+            if (slot.key == key) return i;
+            i = (i + 1) & mask;
+        }
+    }
+
+    void erase_slot(size_t i) noexcept {
+        // Shift the following entries backwards until an empty slot or an entry in its home slot.
+        size_t next = (i + 1) & mask;
+        while (slots[next].dist > 1) {
+            slots[i] = std::move(slots[next]);
+            slots[i].dist--;
+            i = next;
+            next = (next + 1) & mask;
+        }
+        slots[i].dist = 0;
+        count--;
+    }
+
+public:
+    V* find(K key) noexcept {
+        size_t i = find_slot(key);
+        return i == (size_t)-1 ? nullptr : &slots[i].value;
+    }
+
+    // Insert or update an entry. The reference returned is valid until the map is modified.
+    V& insert_or_assign(K key, const V& value) {
+        size_t i = find_slot(key);
+        if (i != (size_t)-1) {
+            slots[i].value = value;
+            return slots[i].value;
+        }
+        // Keep load factor under 7/8.
+        if ((count + 1) * 8 > slots.size() * 7) grow();
+        i = place(slot_t{key, 0, value});
+        count++;
+        return slots[i].value;
+    }
+
+    bool erase(K key) noexcept {
+        size_t i = find_slot(key);
+        if (i == (size_t)-1) return false;
+        erase_slot(i);
+        return true;
+    }
+
+    // Erase all entries for which filter(key, value) returns true. Returns the number of entries
+    // erased. Entries kept may be passed to filter more than once.
+    template<typename Filter>
+    size_t erase_if(Filter filter) {
+        size_t erased = 0;
+        for (size_t i = 0; i < slots.size(); ) {
+            auto& slot = slots[i];
+            if (slot.dist && filter(slot.key, slot.value)) {
+                // Backward shift moves the next entry into this slot, so check it again.
+                erase_slot(i);
+                erased++;
+            } else {
+                i++;
+            }
+        }
+        return erased;
+    }
+
+    void clear() noexcept {
+        for (auto& slot: slots) slot.dist = 0;
+        count = 0;
+    }
+
+    size_t size() const noexcept { return count; }
+    bool empty() const noexcept { return count == 0; }
+};
+
+}
+
+#endif // TLBSIM_FLAT_MAP_H
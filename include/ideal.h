@@ -4,108 +4,235 @@
  *
  * This header defines an ideal TLB, which has infinite memory. Ideal TLB never evicts entries.
  * This is similar to associative TLBs with very large size, but has better performance by using
- * hashmaps.
+ * flat hashmaps. Entries are indexed so that each type of flush takes time proportional to the
+ * number of entries removed, times the number of granularities held.
  */
 
 #ifndef TLBSIM_IDEAL_H
 #define TLBSIM_IDEAL_H
 
-#include <unordered_map>
+#include <memory>
+#include <vector>
 
 #include "tlb.h"
 #include "util.h"
+#include "flat_map.h"
 
 namespace tlbsim {
 
-class IdealTLB: public TLB {
+class IdealTLB: public TLBImpl<IdealTLB> {
 private:
-    std::unordered_map<uint64_t, tlb_entry_t> map;
-    std::unordered_map<uint64_t, tlb_entry_t> g_map;
+    // Non-global entries are additionally linked into a doubly-linked list per VPN, threaded
+    // through the ASIDs of the entries. This allows a flush of a single page for all ASIDs to
+    // only visit the entries removed.
+    static constexpr int32_t NIL = -1;
+    struct ideal_entry_t {
+        tlb_entry_t entry;
+        int32_t prev;
+        int32_t next;
+    };
+
+    // Entries are grouped by realm, so flushing a whole realm is simply dropping its maps.
+    struct realm_t {
+        // Keyed by VPN and ASID.
+        FlatMap<ideal_entry_t> map;
+        // Keyed by VPN.
+        FlatMap<tlb_entry_t> g_map;
+        // Keyed by VPN. Head of ASID list.
+        FlatMap<int32_t> heads;
+    };
+
+    // Entries of each granularity are kept apart, so realms are indexed by realm and granularity.
+    // VPNs in keys are aligned to the granularity.
+    static constexpr int GRANULARITIES = MAX_GRANULARITY + 1;
+    std::vector<std::unique_ptr<realm_t>> realms;
+    granularity_set_t granularities;
     Spinlock lock;
-public:
-    IdealTLB(TLB* parent, tlb_stats_t* stats): TLB(parent, stats, -1) {}
-    bool find_and_lock(tlb_entry_t& search) override {
-        lock.lock();
-        uint64_t key = (search.vpn << 24) | search.asid.realm_asid();
-        auto iter = g_map.find(key &~ 0xffff);
-        if (iter != g_map.end()) {
-            search = iter->second;
-            return true;
+
+    static uint64_t key(uint64_t vpn, int asid) noexcept {
+        return (vpn << 16) | asid;
+    }
+
+    realm_t* get_realm(int realm, int granularity) noexcept {
+        size_t index = realm * GRANULARITIES + granularity;
+        return index < realms.size() ? realms[index].get() : nullptr;
+    }
+
+    realm_t& get_or_create_realm(int realm, int granularity) {
+        size_t index = realm * GRANULARITIES + granularity;
+        if (index >= realms.size()) realms.resize(index + 1);
+        auto& ptr = realms[index];
+        if (!ptr) ptr.reset(new realm_t);
+        return *ptr;
+    }
+
+    // Remove an entry from the per-VPN list and erase it.
+    void erase(realm_t& realm, uint64_t vpn, int asid, const ideal_entry_t& entry) noexcept {
+        int32_t prev = entry.prev;
+        int32_t next = entry.next;
+        if (prev != NIL) {
+            realm.map.find(key(vpn, prev))->next = next;
+        } else if (next != NIL) {
+            *realm.heads.find(vpn) = next;
+        } else {
+            realm.heads.erase(vpn);
         }
-        auto iter2 = map.find(key);
-        if (iter2 != map.end()) {
-            search = iter2->second;
-            return true;
+        if (next != NIL) {
+            realm.map.find(key(vpn, next))->prev = prev;
         }
-        return false;
+        realm.map.erase(key(vpn, asid));
     }
 
-    void unlock(const tlb_entry_t&) override {
-        lock.unlock();
+    void account(unsigned spins) noexcept {
+        if (spins) {
+            ++stats->contend;
+            stats->spin += spins;
+        }
     }
 
-    void insert_and_unlock(const tlb_entry_t& insert) override {
-        uint64_t key = (insert.vpn << 24) | insert.asid.realm_asid();
+    bool find_locked(tlb_entry_t& search) noexcept {
+        return granularities.any([&](int granularity) {
+            auto realm = get_realm(search.asid.realm(), granularity);
+            if (!realm) return false;
+            uint64_t vpn = search.vpn & ~granularity_mask(granularity);
+            auto ptr = realm->g_map.find(vpn);
+            if (ptr) {
+                search.hit(*ptr);
+                return true;
+            }
+            auto ptr2 = realm->map.find(key(vpn, search.asid.asid()));
+            if (ptr2) {
+                search.hit(ptr2->entry);
+                return true;
+            }
+            return false;
+        });
+    }
+
+    bool insert_locked(const tlb_entry_t& insert) {
+        bool found = false;
+        granularities.add(insert.granularity);
+        auto& realm = get_or_create_realm(insert.asid.realm(), insert.granularity);
+        uint64_t vpn = insert.vpn & ~granularity_mask(insert.granularity);
         if (insert.asid.global()) {
-            g_map[key &~ 0xffff] = insert;
+            found = realm.g_map.find(vpn) != nullptr;
+            realm.g_map.insert_or_assign(vpn, insert);
         } else {
-            map[key] = insert;
+            uint64_t k = key(vpn, insert.asid.asid());
+            auto ptr = realm.map.find(k);
+            if (ptr) {
+                found = true;
+                ptr->entry = insert;
+            } else {
+                // Link as the new head of the list.
+                int32_t asid = insert.asid.asid();
+                auto head = realm.heads.find(vpn);
+                int32_t next = head ? *head : NIL;
+                realm.map.insert_or_assign(k, {insert, NIL, next});
+                if (next != NIL) realm.map.find(key(vpn, next))->prev = asid;
+                realm.heads.insert_or_assign(vpn, asid);
+            }
         }
-        lock.unlock();
+        return found;
     }
 
-    void flush_local(asid_t asid, uint64_t vpn) override {
-        lock.lock();
+    bool remove_locked(const tlb_entry_t& entry) {
+        auto realm = get_realm(entry.asid.realm(), entry.granularity);
+        if (!realm) return false;
+        uint64_t vpn = entry.vpn & ~granularity_mask(entry.granularity);
+        if (entry.asid.global()) return realm->g_map.erase(vpn);
+        auto ptr = realm->map.find(key(vpn, entry.asid.asid()));
+        if (!ptr) return false;
+        erase(*realm, vpn, entry.asid.asid(), *ptr);
+        return true;
+    }
+
+    // Flush entries of a realm of one granularity. If page is true, only entries of vpn are flushed,
+    // which is aligned to the granularity and may therefore be 0.
+    uint64_t flush_realm(realm_t& realm, asid_t asid, bool page, uint64_t vpn) {
         uint64_t num_flush = 0;
-        if (vpn == 0) {
+        if (!page) {
+            // Both ASID and full flushes drop all non-global entries of the realm.
+            num_flush += realm.map.size();
+            realm.map = FlatMap<ideal_entry_t>();
+            realm.heads = FlatMap<int32_t>();
             if (asid.global()) {
-                for (auto iter = g_map.begin(); iter != g_map.end(); ) {
-                    if (iter->second.asid.realm() == asid.realm()) {
-                        num_flush++;
-                        iter = g_map.erase(iter);
-                    } else {
-                        ++iter;
-                    }
-                }
+                num_flush += realm.g_map.size();
+                realm.g_map = FlatMap<tlb_entry_t>();
             }
-            for (auto iter = map.begin(); iter != map.end(); ) {
-                if (iter->second.asid.realm() == asid.realm()) {
+        } else if (asid.global()) {
+            if (realm.g_map.erase(vpn)) num_flush++;
+            auto head = realm.heads.find(vpn);
+            if (head) {
+                for (int32_t cur = *head; cur != NIL; ) {
+                    uint64_t k = key(vpn, cur);
+                    cur = realm.map.find(k)->next;
+                    realm.map.erase(k);
                     num_flush++;
-                    iter = map.erase(iter);
-                } else {
-                    ++iter;
                 }
+                realm.heads.erase(vpn);
             }
         } else {
-            uint64_t key = (vpn << 24) | asid.realm_asid();
-            if (asid.global()) {
-                key &=~ 0xffff;
-                auto iter = g_map.find(key);
-                if (iter != g_map.end()) {
-                    num_flush++;
-                    g_map.erase(iter);
-                }
-                for (auto iter = map.begin(); iter != map.end(); ) {
-                    if ((iter->first &~ 0xffff) == key) {
-                        num_flush++;
-                        iter = map.erase(iter);
-                    } else {
-                        ++iter;
-                    }
-                }
-            } else {
-                auto iter = map.find(key);
-                if (iter != map.end()) {
-                    num_flush++;
-                    map.erase(iter);
-                }
+            auto ptr = realm.map.find(key(vpn, asid.asid()));
+            if (ptr) {
+                erase(realm, vpn, asid.asid(), *ptr);
+                num_flush++;
             }
         }
+        return num_flush;
+    }
+
+public:
+    IdealTLB(TLB* parent, tlb_stats_t* stats): TLBImpl(parent, stats, -1) {}
+    bool find(tlb_entry_t& search) override final {
+        account(lock.lock());
+        bool found = find_locked(search);
+        lock.unlock();
+        return found;
+    }
+
+    bool insert(const tlb_entry_t& insert) override final {
+        account(lock.lock());
+        bool found = insert_locked(insert);
+        lock.unlock();
+        return found;
+    }
+
+    void find_batch(tlb_entry_t* searches, bool* hits, size_t count) {
+        account(lock.lock());
+        for (size_t i = 0; i < count; i++) hits[i] = find_locked(searches[i]);
+        lock.unlock();
+    }
+
+    void insert_batch(const tlb_entry_t* const* inserts, bool* replaced, size_t count) {
+        account(lock.lock());
+        for (size_t i = 0; i < count; i++) replaced[i] = insert_locked(*inserts[i]);
+        lock.unlock();
+    }
+
+    bool remove(const tlb_entry_t& entry) override final {
+        account(lock.lock());
+        bool found = remove_locked(entry);
+        lock.unlock();
+        return found;
+    }
+
+    void back_invalidate(const tlb_entry_t& entry) override {
+        if (remove(entry)) evict(entry, false);
+    }
+
+    void flush_local(asid_t asid, uint64_t vpn) override {
+        lock.lock();
+        uint64_t num_flush = 0;
+        granularities.any([&](int granularity) {
+            auto realm = get_realm(asid.realm(), granularity);
+            if (realm) num_flush += flush_realm(*realm, asid, vpn != 0, vpn & ~granularity_mask(granularity));
+            return false;
+        });
         lock.unlock();
         stats->flush += num_flush;
     }
 };
-
 }
 
 #endif
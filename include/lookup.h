@@ -0,0 +1,59 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ * Copyright (c) 2019, Gary Guo
+ *
+ * This header declares the lookup kernels used by associative sets. Tags are stored in a
+ * structure-of-arrays layout so that the kernels can match several ways at once using SIMD.
+ */
+
+#ifndef TLBSIM_LOOKUP_H
+#define TLBSIM_LOOKUP_H
+
+#include <cstdint>
+
+#include "tlb.h"
+
+namespace tlbsim {
+
+// VPN tag of a way that does not hold a valid entry. VPNs are at most 52 bits, so this value can
+// never collide with a VPN being looked up.
+static constexpr uint64_t INVALID_VPN = ~0ULL;
+
+struct lookup_result_t {
+    // Index of the way that matches, -1 if none.
+    int hit;
+    // Index of the first invalid way, -1 if none. Only meaningful if there is no hit.
+    int free;
+};
+
+// Match `vpn` and `asid` against `size` ways. The matching rule is identical to comparing VPNs
+// and then calling asid_t::match.
+typedef lookup_result_t (*lookup_kernel_t)(const uint64_t* vpns, const int32_t* asids, int size,
+                                           uint64_t vpn, asid_t asid);
+
+// Kernel selected at load time depending on the instruction sets supported by the host. Its name
+// is printed along with the statistics.
+extern lookup_kernel_t lookup_kernel;
+extern const char* lookup_kernel_name;
+
+// Lookup kernel for small associativities known at compile time. It is branch-free and fully
+// unrolled, so it is inlined into the caller instead of being dispatched through lookup_kernel.
+template<int N>
+inline lookup_result_t lookup_fixed(const uint64_t* vpns, const int32_t* asids, uint64_t vpn,
+                                    asid_t asid) {
+    static_assert(N > 0 && N <= 32, "lookup_fixed only supports up to 32 ways");
+    uint32_t hit = 0;
+    uint32_t empty = 0;
+    for (int i = 0; i < N; i++) {
+        // Realm is always matched, ASID is only matched for non-global entries.
+        uint32_t mask = asids[i] < 0 ? 0x3fff0000 : 0x3fffffff;
+        bool match = vpns[i] == vpn && ((asids[i] ^ asid.realm_asid()) & mask) == 0;
+        hit |= (uint32_t)match << i;
+        empty |= (uint32_t)(vpns[i] == INVALID_VPN) << i;
+    }
+    return {hit ? __builtin_ctz(hit) : -1, empty ? __builtin_ctz(empty) : -1};
+}
+
+}
+
+#endif // TLBSIM_LOOKUP_H
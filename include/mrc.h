@@ -0,0 +1,172 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ * Copyright (c) 2019, Gary Guo
+ *
+ * This header provides miss ratio curve analysis of LRU-replaced TLBs using Mattson's stack
+ * algorithm. An LRU TLB of n entries holds exactly the n most recently used translations, so an
+ * access hits in it if and only if the stack distance of the access is at most n. Recording the
+ * distance of each access therefore gives miss counts of all sizes at once. The curve is computed
+ * either exactly from a trace, or estimated from sampled translations during simulation.
+ */
+
+#ifndef TLBSIM_MRC_H
+#define TLBSIM_MRC_H
+
+#include <atomic>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include "tlb.h"
+#include "stats.h"
+#include "flat_map.h"
+
+namespace tlbsim {
+
+class LogReplayer;
+
+// Stack of translations ordered by recency of use.
+// Each entry is stamped with the time of its last access, and a Fenwick tree over time counts the
+// entries stamped at each time, so the number of entries used since an entry is found in
+// logarithmic time. When times run out, entries still in the stack are renumbered.
+// A flushed entry leaves a hole in its place, as the flush leaves an empty way in all TLBs holding
+// the entry. The next insertion below the topmost hole fills it instead of evicting an entry from
+// those TLBs, so the hole is removed and the stack above it is shifted down.
+class LruStack {
+private:
+    using key_t = unsigned __int128;
+    // Key of holes in keys. Real keys take at most 96 bits.
+    static constexpr key_t HOLE = ~(key_t)0;
+
+    // Time of the last access of each entry in the stack.
+    FlatMap<uint64_t, key_t> times;
+    // Fenwick tree over times 1 to capacity, counting both entries and holes.
+    std::vector<uint32_t> tree;
+    // Entry accessed at each time, used for renumbering.
+    std::vector<key_t> keys;
+    // Times of holes, topmost first.
+    std::priority_queue<uint64_t> holes;
+    uint64_t now = 0;
+    // Number of entries and holes.
+    uint64_t depth = 0;
+
+    // Global entries match any ASID, so the ASID is not part of their keys.
+    static key_t make_key(asid_t asid, uint64_t vpn) {
+        uint32_t tag = (int32_t)asid;
+        if (asid.global()) tag &= 0xffff0000;
+        return (key_t)vpn << 32 | tag;
+    }
+
+    void add(uint64_t time, int delta);
+    // Number of entries last accessed at or before time.
+    uint64_t prefix(uint64_t time) const;
+    void renumber();
+    // Replace an entry with a hole.
+    void punch(key_t key, uint64_t time);
+
+public:
+    LruStack();
+
+    // Look up a translation with the ASID and VPN of a request, and move it to the top of the stack
+    // as entry, replacing all entries for the same translation. Returns the stack distance, i.e. 1
+    // plus the number of distinct entries used since the translation was last used, or 0 if it is
+    // not in the stack. If insert is false, the stack is left unchanged.
+    uint64_t access(asid_t asid, uint64_t vpn, const tlb_entry_t& entry, bool insert);
+
+    // Replace entries matching a flush with holes, in the same way as FIFOSet::flush.
+    void flush(asid_t asid, uint64_t vpn);
+
+    // Remove entries for which filter(asid, vpn) returns true, without leaving holes.
+    template<typename Filter>
+    void erase_if(Filter filter) {
+        times.erase_if([&](key_t key, uint64_t time) {
+            if (!filter(asid_t((int32_t)key), (uint64_t)(key >> 32))) return false;
+            add(time, -1);
+            depth--;
+            return true;
+        });
+    }
+
+    // Number of entries in the stack.
+    size_t size() const { return times.size(); }
+};
+
+// Miss counts of LRU TLBs with a given number of sets, for all associativities up to a limit.
+class LruAnalysis {
+private:
+    int idx_bits;
+    std::vector<LruStack> stacks;
+    // Number of accesses with each stack distance. The first element counts accesses to
+    // translations not in the stack, and the last counts those with distances beyond the limit.
+    std::vector<uint64_t> distances;
+
+public:
+    const int sets;
+    const size_t max_assoc;
+
+    LruAnalysis(int sets, size_t max_assoc);
+
+    void access(const tlbsim_req_t& req, const tlb_entry_t& entry, bool insert);
+    void flush(asid_t asid, uint64_t vpn);
+
+    // Number of misses with the given associativity, which must not exceed max_assoc.
+    uint64_t misses(size_t assoc) const;
+};
+
+// A pass-through TLB which estimates the miss ratio curve of fully associative LRU TLBs of all sizes
+// up to max_size, for the accesses reaching it.
+// As in SHARDS, translations are sampled by a hash of their VPN and realm, so all accesses to a
+// sampled translation are sampled. Each sampled access stands for 1/rate accesses, and its stack
+// distance among sampled translations is scaled by the same factor. If more than max_entries
+// translations are sampled, the rate is halved and translations no longer sampled are dropped, so
+// the memory used is bounded.
+class MrcTLB: public TLB {
+private:
+    // Hashes are SAMPLE_BITS wide, and those below threshold are sampled.
+    static constexpr int SAMPLE_BITS = 24;
+
+    Spinlock lock;
+    LruStack stack;
+    std::atomic<uint32_t> threshold;
+    size_t max_entries;
+    size_t max_size;
+    sharded_u64_t accesses;
+    // Estimated number of accesses with each stack distance, indexed like those of LruAnalysis.
+    std::vector<double> distances;
+    // All MRC TLBs are linked together, so their curves can be reported.
+    MrcTLB* next_mrc;
+    friend void print_mrc_curves();
+    friend void reset_mrc_curves();
+
+    static uint32_t sample_hash(asid_t asid, uint64_t vpn) {
+        uint64_t hash = vpn ^ (uint64_t)asid.realm() << 52;
+        // Finaliser of MurmurHash3
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53ULL;
+        hash ^= hash >> 33;
+        return hash >> (64 - SAMPLE_BITS);
+    }
+
+public:
+    MrcTLB(TLB* parent, tlb_stats_t* stats, double rate, size_t max_entries, size_t max_size);
+    int access(tlb_entry_t &search, const tlbsim_req_t& req) override;
+    void flush_local(asid_t asid, uint64_t vpn) override;
+};
+
+// Print curves of all MRC TLBs, summed up over instances of the same level.
+void print_mrc_curves();
+void reset_mrc_curves();
+
+// Geometries to analyse. Empty if no analysis is configured.
+extern std::vector<LruAnalysis*> config_analysis;
+// File to write all points of the curves to, or empty.
+extern std::string config_analysis_file;
+
+// Replay the whole trace once into all geometries, and print their miss ratio curves.
+void replay_analysis(LogReplayer& replayer);
+
+}
+
+#endif // TLBSIM_MRC_H
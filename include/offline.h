@@ -8,41 +8,152 @@
 #ifndef TLBSIM_OFFLINE_H
 #define TLBSIM_OFFLINE_H
 
+#include <atomic>
 #include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "tlb.h"
+#include "trace.h"
 #include "util.h"
 
 namespace tlbsim {
 
 // The TLB architecture when using AccessLogger:
 //     ISASim --> L1 --> AccessLogger --> PageWalker
+// Each hart appends packets to its own ring buffer, tagged with a global sequence number. A
+// background thread merges the buffers in sequence order and writes them out in large batches.
 class AccessLogger: public TLB {
 private:
+    static constexpr size_t RING_SIZE = 4096;
+    // Number of packets written at once for version 1 traces.
+    static constexpr size_t BATCH_SIZE = 4096;
+
+    struct record_t {
+        uint64_t seq;
+        uint64_t instret;
+        packet_t packet;
+    };
+
+    // Single-producer single-consumer ring buffer of a hart.
+    struct ring_t {
+        // Written by the hart.
+        alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head {0};
+        // Number of times the hart found the buffer full, and rounds it waited for.
+        uint64_t stall = 0;
+        uint64_t spin = 0;
+        // Written by the writer thread.
+        alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tail {0};
+        record_t records[RING_SIZE];
+    };
+
     std::ofstream os;
-    Spinlock lock;
+    int version;
+    // Used for version 2 traces.
+    TraceEncoder encoder;
+    // Used for version 1 traces.
+    std::vector<packet_t> batch;
+    // Number of harts seen.
+    uint32_t harts = 0;
+    std::atomic<uint64_t> seq {0};
+    std::atomic<ring_t*> rings[MAX_HARTS] {};
+    std::thread writer;
+    std::atomic<bool> stopping {false};
+    uint64_t writes = 0;
+    // All loggers are linked together, so they can be stopped at exit.
+    AccessLogger* next_logger;
+    friend void stop_access_loggers();
+
+    void log(const packet_t& packet);
+    // Write all packets that are ready in sequence order. Returns false if there is nothing to
+    // write. Only called from the writer thread.
+    bool drain(uint64_t& next);
+    void write(const record_t& record);
+    // Write out packets still buffered.
+    void write_pending();
+
 public:
-    AccessLogger(TLB* parent, std::ofstream&& os): TLB(parent, NULL, -1), os(std::move(os)) {}
+    // config is the configuration being used, which is recorded in version 2 traces.
+    AccessLogger(TLB* parent, std::ofstream&& os, int version, bool compress, const std::string& config);
     int access(tlb_entry_t &search, const tlbsim_req_t& req) override;
     void flush(asid_t asid, uint64_t vpn) override;
+
+    // Stop the writer thread after writing all packets logged, and print backpressure statistics.
+    void stop();
 };
 
+// Stop all access loggers instantiated.
+void stop_access_loggers();
+
 // The TLB architecture when using AccessLogger:
 //     LogReplayer (initiater) --> DUT --> LogReplayer (replayer)
+// Both version 1 and version 2 traces are accepted.
 class LogReplayer: public TLB {
 private:
-    std::ifstream is;
-    tlb_entry_t search_ut;
-    tlbsim_req_t req_ut;
+    TraceInput input;
+    trace_header_t header;
+    TraceDecoder decoder;
+    // Last packet decoded from a version 2 trace.
+    packet_t decoded;
+    // Packet being replayed. For version 1 traces, this points into the input directly.
+    const packet_t* current = nullptr;
+    uint64_t accesses = 0;
+    uint64_t flushes = 0;
+
 public:
-    LogReplayer(std::ifstream&& is): TLB(NULL, NULL, -1), is(std::move(is)) {}
+    // Path "-" means the standard input.
+    LogReplayer(const char* path);
     int access(tlb_entry_t &search, const tlbsim_req_t& req) override;
     void flush(asid_t asid, uint64_t vpn) override {}
 
+    int version() const { return header.version; }
+    // Number of harts recorded in the trace, or 0 if unknown.
+    int harts() const { return header.harts; }
+
+    // Number of packets replayed so far.
+    uint64_t replayed_accesses() const { return accesses; }
+    uint64_t replayed_flushes() const { return flushes; }
+
+    // Get the next packet from input, or nullptr at the end. The packet is valid until the next
+    // call.
+    const packet_t* next();
+
     // Read and replay one single entry from input stream.
     bool replay_step(TLB* target);
 };
 
+// The bottom of a hierarchy replayed in a sweep. Like LogReplayer, it returns the translation
+// recorded in the packet being replayed, but each hierarchy has its own, so they can be replayed
+// by different threads.
+class ReplayTerminal: public TLB {
+public:
+    const packet_t* current = nullptr;
+
+    ReplayTerminal(): TLB(NULL, NULL, -1) {}
+    int access(tlb_entry_t &search, const tlbsim_req_t& req) override;
+    void flush(asid_t asid, uint64_t vpn) override {}
+};
+
+// A configuration evaluated in a sweep.
+struct sweep_point_t {
+    // Values of swept parameters, e.g. "stlb.0.size=1024 stlb.0.assoc=8".
+    std::string label;
+    ReplayTerminal* terminal;
+    TLB* stlb;
+    // Statistics of each level of stlb.
+    std::vector<tlb_stats_t*> stats;
+};
+
+// Points of the sweep to replay the trace into. Empty if no sweep is configured.
+extern std::vector<sweep_point_t> config_sweep;
+// Number of threads to replay the sweep with. 0 means one per hardware thread.
+extern int config_sweep_threads;
+
+// Replay the whole trace once, feeding each packet to all points of the sweep, and print a table
+// of results for each point.
+void replay_sweep(LogReplayer& replayer);
+
 }
 
 #endif
@@ -0,0 +1,57 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ * Copyright (c) 2019, Gary Guo
+ *
+ * This header keeps track of configured TLB levels and their statistics, and provides export of
+ * all counters in machine-readable formats.
+ */
+
+#ifndef TLBSIM_REPORT_H
+#define TLBSIM_REPORT_H
+
+#include <string>
+#include <vector>
+#include <json/json.h>
+
+#include "stats.h"
+
+namespace tlbsim {
+
+// A configured level of a TLB hierarchy. Levels of private hierarchies are instantiated once per
+// hart; all instances share the same statistics and are told apart by the per-hart shards.
+struct tlb_level_t {
+    // Hierarchy the level belongs to, i.e. "stlb", "ctlb", "itlb" or "dtlb".
+    std::string group;
+    // Position in the hierarchy, 0 being the closest to the core.
+    int index;
+    // The descriptor the level is configured with.
+    Json::Value config;
+    // Index of the sweep point the level belongs to, or -1 if it is not part of a sweep.
+    int point;
+    tlb_stats_t stats;
+
+    // Name of the level, e.g. "itlb.0", or "sweep.3.stlb.0" for levels of sweep point 3.
+    std::string name() const;
+};
+
+// Register a level and return the statistics its instances should use.
+tlb_stats_t* add_tlb_level(const char* group, int index, const Json::Value& config, int point = -1);
+
+// All registered levels, in the order they are configured.
+const std::vector<tlb_level_t*>& tlb_levels();
+
+// Print statistics of all levels of a hierarchy, summed up. Levels of sweep points are excluded.
+void print_tlb_group(const char* group, const char* name);
+
+void reset_tlb_levels();
+
+// Set the file to export statistics to. format is either "json" or "csv".
+void set_stats_file(const std::string& file, const std::string& format);
+
+// Take a snapshot of all counters and append it to the statistics file, if there is one. reason is
+// recorded to tell snapshots apart.
+void export_counters(const char* reason);
+
+}
+
+#endif // TLBSIM_REPORT_H
@@ -0,0 +1,108 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ * Copyright (c) 2019, Gary Guo
+ *
+ * This header provides interval sampling of statistics counters, so that phase behaviour can be
+ * observed instead of only totals between resets.
+ */
+
+#ifndef TLBSIM_SAMPLER_H
+#define TLBSIM_SAMPLER_H
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "api.h"
+#include "stats.h"
+
+namespace tlbsim {
+
+// Samples counters every `interval` retired instructions or accesses. Samples are taken by the
+// simulating threads into a preallocated bounded queue without locking or allocation, and a
+// background thread writes them to a CSV file. If the writer falls behind and the queue is full,
+// samples are dropped and counted instead of blocking the simulation.
+class Sampler {
+private:
+    // Accesses are counted per hart and only added to the global count in batches, so that harts
+    // do not contend on a cache line for each access.
+    static constexpr uint32_t ACCESS_BATCH = 64;
+
+    struct alignas(CACHE_LINE_SIZE) pending_t {
+        uint32_t count;
+    };
+
+    // Slot i of the queue is ready to be written in round n if seq == n * capacity + i, and ready
+    // to be read if seq == n * capacity + i + 1.
+    struct alignas(CACHE_LINE_SIZE) slot_t {
+        std::atomic<uint64_t> seq;
+    };
+
+    bool by_instret;
+    uint64_t interval;
+    std::atomic<uint64_t> next_sample;
+    std::atomic<uint64_t> accesses {0};
+    pending_t pending[MAX_HARTS] {};
+
+    // Counters sampled, in the order of columns, following the access count (if sampling by
+    // accesses), instret and minstret.
+    std::vector<const sharded_u64_t*> counters;
+    std::vector<std::string> names;
+    size_t width;
+
+    size_t capacity;
+    std::unique_ptr<slot_t[]> slots;
+    std::unique_ptr<uint64_t[]> data;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head {0};
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tail {0};
+    std::atomic<uint64_t> dropped {0};
+
+    FILE* file;
+    std::thread writer;
+    std::atomic<bool> stopping {false};
+
+    void sample(uint64_t now);
+    // Write all ready samples to the file. Only called from the writer thread.
+    void drain();
+
+public:
+    // capacity is rounded up to a power of two.
+    Sampler(FILE* file, bool by_instret, uint64_t interval, size_t capacity);
+
+    // Start the writer thread. Counters and TLB levels must have been set up by then.
+    void start();
+
+    // Stop the writer thread and write all remaining samples.
+    void stop();
+
+    // Called for each access.
+    void tick() {
+        uint64_t now;
+        if (by_instret) {
+            now = __atomic_load_n(&tlbsim_instret, __ATOMIC_RELAXED);
+        } else {
+            auto& count = pending[current_hart].count;
+            if (++count < ACCESS_BATCH) return;
+            count = 0;
+            now = accesses.fetch_add(ACCESS_BATCH, std::memory_order_relaxed) + ACCESS_BATCH;
+        }
+        uint64_t next = next_sample.load(std::memory_order_relaxed);
+        if (now < next) return;
+        // Only the hart that advances the threshold takes the sample.
+        if (!next_sample.compare_exchange_strong(next, now - now % interval + interval, std::memory_order_relaxed)) return;
+        sample(now);
+    }
+
+    // Counters are about to be reset, restart from the first interval.
+    void reset() {
+        accesses.store(0, std::memory_order_relaxed);
+        next_sample.store(interval, std::memory_order_relaxed);
+    }
+};
+
+}
+
+#endif // TLBSIM_SAMPLER_H
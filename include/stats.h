@@ -7,48 +7,136 @@
 #define TLBSIM_STATS_H
 
 #include "util.h"
+#include "config.h"
 
 namespace tlbsim {
 
+// Hart on whose behalf the calling thread is simulating. Set by the API entry points, and used to
+// pick the shard of statistics counters.
+extern thread_local int current_hart __attribute__((tls_model("initial-exec")));
+
+// A counter sharded per hart. Each shard occupies its own cache line, so harts running on different
+// threads never contend. Shards are only summed up when the counter is read.
+struct sharded_u64_t {
+    struct alignas(CACHE_LINE_SIZE) shard_t {
+        std::atomic<uint64_t> counter;
+        // Value of counter at the last reset, which is subtracted when the shard is read.
+        std::atomic<uint64_t> base;
+
+        uint64_t value() const noexcept {
+            return counter.load(std::memory_order_relaxed) - base.load(std::memory_order_relaxed);
+        }
+    };
+    shard_t shards[MAX_HARTS];
+
+    // A hart is only simulated by one thread at a time, so each shard has a single writer and an
+    // atomic read-modify-write is not needed. Resets are the exception, as they happen from any
+    // thread while other harts keep running; they only write base, so an increment racing with a
+    // reset is counted either before or after it.
+    void add(uint64_t value) noexcept {
+        auto& counter = shards[current_hart].counter;
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    sharded_u64_t& operator ++() noexcept {
+        add(1);
+        return *this;
+    }
+
+    sharded_u64_t& operator +=(uint64_t value) noexcept {
+        add(value);
+        return *this;
+    }
+
+    // Reset all shards. The value is attributed to the first shard.
+    sharded_u64_t& operator =(uint64_t value) noexcept {
+        for (auto& shard: shards) {
+            shard.base.store(shard.counter.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        auto& base = shards[0].base;
+        base.store(base.load(std::memory_order_relaxed) - value, std::memory_order_relaxed);
+        return *this;
+    }
+
+    // Value of a single hart.
+    uint64_t operator [](int hartid) const noexcept {
+        return shards[hartid].value();
+    }
+
+    // Sum of all harts.
+    uint64_t operator *() const noexcept {
+        uint64_t sum = 0;
+        for (auto& shard: shards) sum += shard.value();
+        return sum;
+    }
+
+    // Add another counter to this one, shard by shard.
+    void merge(const sharded_u64_t& other) noexcept {
+        for (int i = 0; i < MAX_HARTS; i++) {
+            auto& counter = shards[i].counter;
+            counter.store(counter.load(std::memory_order_relaxed) + other[i], std::memory_order_relaxed);
+        }
+    }
+};
+
 // Global page fault statistics
-extern atomic_u64_t v_fault;
-extern atomic_u64_t u_fault;
-extern atomic_u64_t s_fault;
-extern atomic_u64_t r_fault;
-extern atomic_u64_t w_fault;
-extern atomic_u64_t x_fault;
-extern atomic_u64_t a_fault;
-extern atomic_u64_t d_fault;
+extern sharded_u64_t v_fault;
+extern sharded_u64_t u_fault;
+extern sharded_u64_t s_fault;
+extern sharded_u64_t r_fault;
+extern sharded_u64_t w_fault;
+extern sharded_u64_t x_fault;
+extern sharded_u64_t a_fault;
+extern sharded_u64_t d_fault;
 
 // Global TLB flush statistics
-extern atomic_u64_t flush_full;
-extern atomic_u64_t flush_gpage;
-extern atomic_u64_t flush_asid;
-extern atomic_u64_t flush_page;
+extern sharded_u64_t flush_full;
+extern sharded_u64_t flush_gpage;
+extern sharded_u64_t flush_asid;
+extern sharded_u64_t flush_page;
+
+// Global page walk statistics. Loads saved are PTE loads skipped by hits in page walk caches.
+extern sharded_u64_t walks;
+extern sharded_u64_t walk_loads;
+extern sharded_u64_t walk_saved;
 
 // Per-TLB statistics
 struct tlb_stats_t {
-    atomic_u64_t miss;
-    atomic_u64_t evict;
-    atomic_u64_t flush;
+    sharded_u64_t miss;
+    sharded_u64_t evict;
+    sharded_u64_t flush;
+    // Lock acquisitions in the access path that had to wait for another hart.
+    sharded_u64_t contend;
+    // Backoff rounds (or optimistic read retries) spent in contended acquisitions.
+    sharded_u64_t spin;
+    // Misses whose translation was inserted by another hart while walking.
+    sharded_u64_t race;
 
     void reset() {
         miss = 0;
         evict = 0;
         flush = 0;
+        contend = 0;
+        spin = 0;
+        race = 0;
+    }
+
+    void merge(const tlb_stats_t& other) {
+        miss.merge(other.miss);
+        evict.merge(other.evict);
+        flush.merge(other.flush);
+        contend.merge(other.contend);
+        spin.merge(other.spin);
+        race.merge(other.race);
     }
 
     void print(const char* name);
 };
 
-extern tlb_stats_t itlb_stats;
-extern tlb_stats_t dtlb_stats;
-extern tlb_stats_t ctlb_stats;
-extern tlb_stats_t stlb_stats;
-
 void print_instrets();
 void print_faults();
 void print_flushes();
+void print_walks();
 
 }
 
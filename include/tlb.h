@@ -8,6 +8,8 @@
 
 #include "pgtable.h"
 #include "api.h"
+#include "config.h"
+#include "stats.h"
 
 namespace tlbsim {
 
@@ -69,14 +71,75 @@ struct asid_t {
     }
 };
 
+// Granularities of translations, i.e. the level of the leaf PTE. 0 is a 4K page, 1 a 2M page, etc.
+static constexpr int MAX_GRANULARITY = 3;
+
+// Mask of the VPN bits which are offsets within a page of the granularity.
+inline uint64_t granularity_mask(int granularity) {
+    return (1ULL << (granularity * 9)) - 1;
+}
+
+// Tag of the entry of a granularity that would translate vpn. 4K entries are tagged by their VPN,
+// and superpage entries by their first VPN with the granularity in bits 60 and above, which are
+// never set in VPNs.
+inline uint64_t vpn_tag(uint64_t vpn, int granularity) {
+    return (vpn & ~granularity_mask(granularity)) | (uint64_t)granularity << 60;
+}
+
 // Represent an TLB entry.
 // This is the internally-used exchange formats between all different types of TLB.
+// A superpage is cached as a single entry, which keeps the VPN and PPN of the 4K page it was filled
+// for, and translates all VPNs within the superpage.
 struct tlb_entry_t {
     uint64_t vpn;
     uint64_t ppn;
     uint64_t pte;
     asid_t asid;
     int granularity;
+
+    uint64_t tag() const noexcept { return vpn_tag(vpn, granularity); }
+
+    // Whether the entry translates vpn.
+    bool covers(uint64_t vpn) const noexcept {
+        return ((vpn ^ this->vpn) & ~granularity_mask(granularity)) == 0;
+    }
+
+    // Fill this search for vpn from a cached entry that covers it. VPN and PPN are that of the 4K
+    // page being searched.
+    void hit(const tlb_entry_t& entry) noexcept {
+        uint64_t vpn = this->vpn;
+        *this = entry;
+        uint64_t mask = granularity_mask(entry.granularity);
+        this->vpn = vpn;
+        this->ppn = (entry.ppn & ~mask) | (vpn & mask);
+    }
+};
+
+// Bit mask of granularities of entries a TLB has held. Lookups only probe granularities in the set,
+// so TLBs which never held a superpage only probe 4K entries. Bits are never cleared.
+struct granularity_set_t {
+    std::atomic<uint32_t> mask {1};
+
+    void add(int granularity) noexcept {
+        uint32_t bit = 1 << granularity;
+        if (!(mask.load(std::memory_order_relaxed) & bit)) mask.fetch_or(bit, std::memory_order_relaxed);
+    }
+
+    // Call f for each granularity in the set, smallest first, until it returns true. Returns
+    // whether any call returned true.
+    template<typename F>
+    bool any(F f) const {
+        return f(0) || any_superpage(f);
+    }
+
+    // Same as any, but for granularities of superpages only.
+    template<typename F>
+    bool any_superpage(F f) const {
+        for (uint32_t bits = mask.load(std::memory_order_relaxed) & ~1; bits; bits &= bits - 1) {
+            if (f(__builtin_ctz(bits))) return true;
+        }
+        return false;
+    }
 };
 
 /*
@@ -88,36 +151,110 @@ struct tlb_entry_t {
  */
 int pte_permission_check(int pte, const tlbsim_req_t& req);
 
-struct tlb_stats_t;
+// Maximum number of distinct pages queued for invalidation in the L0 TLB of a hart. Beyond this, the
+// L0 TLB is invalidated entirely.
+static constexpr int MAX_L0_INVALIDATIONS = 16;
+
+// Invalidate a page in the L0 TLB of a hart, or all pages if vpn is 0, to keep it inclusive. Type is
+// the same as in tlbsim_client_t::invalidate_l0. Invalidations are queued, and passed to the client
+// together by flush_l0.
+void invalidate_l0(int hartid, uint64_t vpn, int type);
+
+// Pass the queued L0 invalidations of a hart to the client. This is called before the simulator
+// returns from a request or flush of the hart, so the guest never sees a non-inclusive L0 TLB.
+void flush_l0(int hartid);
+
+// Maximum number of requests passed to TLB::access_batch at once.
+static constexpr size_t MAX_BATCH = 64;
+
+// How the entries of a level relate to those of the levels directly above it, which are closer to
+// the core. The L0 TLB of the client is above the first private level of a hart.
+enum class inclusion_t {
+    // Entries are kept above when they are evicted.
+    NON_INCLUSIVE,
+    // Entries evicted are also removed above, so the levels above only hold entries of this level.
+    INCLUSIVE,
+    // Entries move up on a hit instead of being copied, misses are only filled above, and entries
+    // evicted from the level directly above are spilled into this level.
+    EXCLUSIVE,
+};
 
 class TLB {
 public:
+    // Maximum number of levels directly above a level, which are the I-TLB and D-TLB of each hart.
+    static constexpr int MAX_CHILDREN = MAX_HARTS * 2;
+
     TLB* parent;
     tlb_stats_t* stats;
     // Associated hart ID. Only used for L1 cache to enforce L0 inclusion policy.
-    // -1 should be used for non-L1 caches.
+    // -1 should be used for non-L1 caches, and for L1 caches which are not inclusive.
     int hartid;
+    inclusion_t inclusion = inclusion_t::NON_INCLUSIVE;
+    // Levels directly above, which entries evicted from an inclusive level are removed from.
+    // Private levels are added as harts are set up, so the array is only appended to, and is read
+    // up to num_children without locking.
+    std::atomic<int> num_children {0};
+    TLB* children[MAX_CHILDREN];
 
     TLB(TLB* parent, tlb_stats_t* stats, int hartid): parent{parent}, stats{stats}, hartid{hartid} {}
 
-    // Find an entry, and acquire a (possibly) fine-grained lock that prevents
-    // any race to the entry.
-    virtual bool find_and_lock(tlb_entry_t &entry) { return false; }
+    // Register a level directly above this one.
+    void add_child(TLB* child);
+
+    // Whether evict needs to be called for entries evicted from this level.
+    bool tracks_evictions() const noexcept {
+        return inclusion == inclusion_t::INCLUSIVE || parent->inclusion == inclusion_t::EXCLUSIVE;
+    }
 
-    // Relase a (possibly) find-grained lock for an entry.
-    virtual void unlock(const tlb_entry_t &entry) {}
+    // Handle an entry evicted from this level. If this level is inclusive, the entry is removed
+    // from the levels above, and if the parent is exclusive, it is spilled into the parent unless
+    // spill is false. No lock may be held, as other levels are accessed.
+    void evict(const tlb_entry_t& entry, bool spill);
 
-    // Insert an entry, and unlock.
-    virtual void insert_and_unlock(const tlb_entry_t &entry) {}
+    // Find an entry. A (possibly) fine-grained lock is only held during the lookup, so it is not
+    // held while the parent is accessed on a miss.
+    virtual bool find(tlb_entry_t &entry) { return false; }
+
+    // Insert an entry. As the lock is not held since find, another hart may have inserted the same
+    // translation in the meantime. In that case the existing entry is replaced instead of being
+    // duplicated, and true is returned.
+    virtual bool insert(const tlb_entry_t &entry) { return false; }
 
     virtual void flush_local(asid_t asid, uint64_t vpn) {}
 
+    // Remove the entry of a translation if it is held, without counting it as flushed. Returns
+    // whether it was held.
+    virtual bool remove(const tlb_entry_t& entry) { return false; }
+
+    // Remove an entry evicted from an inclusive level below. Levels which hold entries remove it
+    // and evict it in turn, and others pass it on to the levels above.
+    virtual void back_invalidate(const tlb_entry_t& entry);
+
     virtual int access(tlb_entry_t &search, const tlbsim_req_t& req);
 
+    // Access up to MAX_BATCH requests, storing the result of each in perms. By default they are
+    // accessed one by one.
+    virtual void access_batch(tlb_entry_t* searches, const tlbsim_req_t* reqs, int* perms, size_t count) {
+        for (size_t i = 0; i < count; i++) perms[i] = access(searches[i], reqs[i]);
+    }
+
     virtual void flush(asid_t asid, uint64_t vpn) {
         flush_local(asid, vpn);
         parent->flush(asid, vpn);
     }
+
+protected:
+    // Implementation of access in terms of find and insert of Self.
+    template<typename Self>
+    static int access_impl(Self* self, tlb_entry_t &search, const tlbsim_req_t& req);
+
+    // Implementation of access_batch in terms of find_batch and insert_batch of Self.
+    template<typename Self>
+    static void access_batch_impl(Self* self, tlb_entry_t* searches, const tlbsim_req_t* reqs, int* perms, size_t count);
+
+    // Access the deferred requests of a batch as a batch of their own.
+    template<typename Self>
+    static void access_deferred(Self* self, tlb_entry_t* searches, const tlbsim_req_t* reqs, int* perms, const uint8_t* deferred, size_t num_deferred);
 };
 
 extern class PageWalker final: public TLB {
@@ -127,6 +264,152 @@ public:
     void flush(asid_t asid, uint64_t vpn) override {}
 } page_walker;
 
+template<typename Self>
+inline int TLB::access_impl(Self* self, tlb_entry_t &search, const tlbsim_req_t& req) {
+    int perm;
+    bool hit = self->find(search);
+    if (hit) {
+        perm = pte_permission_check(search.pte, req);
+        if (perm < 0 || (perm > 0 && !config_update_pte)) return perm;
+        // An exclusive level passes the entry up instead of keeping a copy.
+        if (self->inclusion == inclusion_t::EXCLUSIVE) self->remove(search);
+        if (perm == 0) return perm;
+    }
+
+    ++self->stats->miss;
+
+    // Call the page walker directly in the common case that it is the parent.
+    if (self->parent == &page_walker) {
+        perm = page_walker.access(search, req);
+    } else {
+        perm = self->parent->access(search, req);
+    }
+    // Misses of an exclusive level are only filled above.
+    if (self->inclusion == inclusion_t::EXCLUSIVE) return perm;
+    if (!config_cache_inv && perm != 0) return perm;
+
+    // If we hit but need to update the PTE, the entry is expected to be replaced.
+    if (self->insert(search) && !hit) ++self->stats->race;
+    return perm;
+}
+
+// All requests of a batch are looked up before any miss is inserted, as in hardware looking up
+// several requests at once, and misses go to the parent as a batch. A request for the same page as
+// an earlier miss would hit the entry inserted for it, so it is deferred until after the insertion.
+template<typename Self>
+inline void TLB::access_batch_impl(Self* self, tlb_entry_t* searches, const tlbsim_req_t* reqs, int* perms, size_t count) {
+    bool hits[MAX_BATCH];
+    self->find_batch(searches, hits, count);
+
+    // Indices of requests which miss, and of those deferred.
+    uint8_t misses[MAX_BATCH];
+    uint8_t deferred[MAX_BATCH];
+    size_t num_misses = 0;
+    size_t num_deferred = 0;
+    tlb_entry_t miss_searches[MAX_BATCH];
+    tlbsim_req_t miss_reqs[MAX_BATCH];
+    int miss_perms[MAX_BATCH];
+    for (size_t i = 0; i < count; i++) {
+        auto& search = searches[i];
+        if (hits[i]) {
+            perms[i] = pte_permission_check(search.pte, reqs[i]);
+            if (perms[i] < 0 || (perms[i] > 0 && !config_update_pte)) continue;
+            if (self->inclusion == inclusion_t::EXCLUSIVE) self->remove(search);
+            if (perms[i] == 0) continue;
+        }
+
+        bool duplicate = false;
+        for (size_t j = 0; j < num_misses; j++) {
+            if (miss_searches[j].vpn == search.vpn && miss_searches[j].asid == search.asid) {
+                duplicate = true;
+                break;
+            }
+        }
+        if (duplicate) {
+            deferred[num_deferred++] = i;
+            continue;
+        }
+
+        ++self->stats->miss;
+        misses[num_misses] = i;
+        miss_searches[num_misses] = search;
+        miss_reqs[num_misses] = reqs[i];
+        num_misses++;
+    }
+    if (num_misses == 0) return;
+
+    if (self->parent == &page_walker) {
+        for (size_t j = 0; j < num_misses; j++) {
+            miss_perms[j] = page_walker.access(miss_searches[j], miss_reqs[j]);
+        }
+    } else {
+        self->parent->access_batch(miss_searches, miss_reqs, miss_perms, num_misses);
+    }
+
+    const tlb_entry_t* inserts[MAX_BATCH];
+    uint8_t inserted[MAX_BATCH];
+    size_t num_inserts = 0;
+    for (size_t j = 0; j < num_misses; j++) {
+        size_t i = misses[j];
+        searches[i] = miss_searches[j];
+        perms[i] = miss_perms[j];
+        if (self->inclusion == inclusion_t::EXCLUSIVE || (!config_cache_inv && perms[i] != 0)) continue;
+        inserts[num_inserts] = &miss_searches[j];
+        inserted[num_inserts++] = i;
+    }
+    bool replaced[MAX_BATCH];
+    self->insert_batch(inserts, replaced, num_inserts);
+    // If we hit but need to update the PTE, the entry is expected to be replaced.
+    for (size_t k = 0; k < num_inserts; k++) {
+        if (replaced[k] && !hits[inserted[k]]) ++self->stats->race;
+    }
+
+    if (num_deferred) access_deferred(self, searches, reqs, perms, deferred, num_deferred);
+}
+
+// Kept out of line, so that its arrays do not enlarge the stack frame of every batch.
+template<typename Self>
+__attribute__((noinline)) void TLB::access_deferred(Self* self, tlb_entry_t* searches, const tlbsim_req_t* reqs, int* perms, const uint8_t* deferred, size_t num_deferred) {
+    tlb_entry_t deferred_searches[MAX_BATCH];
+    tlbsim_req_t deferred_reqs[MAX_BATCH];
+    int deferred_perms[MAX_BATCH];
+    for (size_t k = 0; k < num_deferred; k++) {
+        deferred_searches[k] = searches[deferred[k]];
+        deferred_reqs[k] = reqs[deferred[k]];
+    }
+    access_batch_impl(self, deferred_searches, deferred_reqs, deferred_perms, num_deferred);
+    for (size_t k = 0; k < num_deferred; k++) {
+        searches[deferred[k]] = deferred_searches[k];
+        perms[deferred[k]] = deferred_perms[k];
+    }
+}
+
+// Base class for TLBs that implement find and insert as final methods. The access path then calls
+// them directly so they can be inlined, instead of going through the vtable once per step.
+template<typename Derived>
+class TLBImpl: public TLB {
+public:
+    using TLB::TLB;
+
+    int access(tlb_entry_t &search, const tlbsim_req_t& req) override {
+        return access_impl(static_cast<Derived*>(this), search, req);
+    }
+
+    void access_batch(tlb_entry_t* searches, const tlbsim_req_t* reqs, int* perms, size_t count) override {
+        access_batch_impl(static_cast<Derived*>(this), searches, reqs, perms, count);
+    }
+
+    // Derived classes may replace these with versions that look up or insert several entries while
+    // holding a lock once.
+    void find_batch(tlb_entry_t* searches, bool* hits, size_t count) {
+        for (size_t i = 0; i < count; i++) hits[i] = static_cast<Derived*>(this)->find(searches[i]);
+    }
+
+    void insert_batch(const tlb_entry_t* const* inserts, bool* replaced, size_t count) {
+        for (size_t i = 0; i < count; i++) replaced[i] = static_cast<Derived*>(this)->insert(*inserts[i]);
+    }
+};
+
 }
 
 #endif // TLBSIM_TLB_H
@@ -0,0 +1,162 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ * Copyright (c) 2019, Gary Guo
+ *
+ * This header defines the formats of access traces.
+ *
+ * Version 1 traces are raw dumps of packet_t, without any header.
+ *
+ * Version 2 traces start with trace_header_t followed by the configuration used to record the
+ * trace, and then a sequence of blocks. Each block is block_header_t followed by its payload, which
+ * is optionally compressed with the codec in codec.h. Once decompressed, the payload is a sequence
+ * of records encoded with varints, where VPN, PPN, SATP and ASID are encoded as differences from
+ * the previous access of the same hart. The state of the encoding is reset at each block, so blocks
+ * can be decoded independently. All integers are little endian.
+ */
+
+#ifndef TLBSIM_TRACE_H
+#define TLBSIM_TRACE_H
+
+#include <cstdio>
+#include <ostream>
+#include <vector>
+
+#include "tlb.h"
+
+namespace tlbsim {
+
+struct packet_t {
+    union {
+        struct {
+            tlbsim_req_t req;
+            tlb_entry_t search;
+        } access;
+        struct {
+            asid_t asid;
+            uint64_t vpn;
+        } flush;
+    };
+    enum {
+        ACCESS,
+        FLUSH
+    } tag;
+};
+
+static constexpr char TRACE_MAGIC[8] = {'T', 'L', 'B', 'T', 'R', 'A', 'C', 'E'};
+static constexpr uint32_t TRACE_ENDIAN = 0x01020304;
+
+struct trace_header_t {
+    char magic[8];
+    uint32_t version;
+    // TRACE_ENDIAN as written by the host recording the trace.
+    uint32_t endian;
+    // Number of harts. This is filled when the recording finishes, so it is 0 if it did not.
+    uint32_t harts;
+    uint32_t flags;
+    // Size of the configuration following the header.
+    uint32_t config_size;
+};
+
+struct block_header_t {
+    enum {
+        COMPRESSED = 1
+    };
+
+    // Size of the payload before and after compression.
+    uint32_t raw_size;
+    uint32_t size;
+    // Number of packets in the block.
+    uint32_t count;
+    uint32_t flags;
+    // Value of tlbsim_instret when the first packet in the block is recorded.
+    uint64_t instret;
+};
+
+// Values of the last access of a hart, which the next access is encoded against.
+struct trace_hart_t {
+    uint64_t satp;
+    uint64_t vpn;
+    uint64_t ppn;
+    uint32_t asid;
+};
+
+class TraceEncoder {
+public:
+    // Raw size of a block before it is written.
+    static constexpr size_t BLOCK_SIZE = 65536;
+
+private:
+    trace_hart_t harts[MAX_HARTS];
+    bool compress;
+    std::vector<uint8_t> block;
+    std::vector<uint8_t> compressed;
+    block_header_t header;
+
+public:
+    TraceEncoder(bool compress);
+
+    void encode(const packet_t& packet, uint64_t instret);
+
+    bool full() const { return block.size() >= BLOCK_SIZE; }
+
+    // Write out the current block, if it is not empty.
+    void flush(std::ostream& os);
+};
+
+class TraceDecoder {
+private:
+    trace_hart_t harts[MAX_HARTS];
+    std::vector<uint8_t> buffer;
+    const uint8_t* ptr = nullptr;
+    const uint8_t* end = nullptr;
+    uint32_t count = 0;
+
+public:
+    // Start decoding a block. The payload must outlive the decoding if it is not compressed.
+    // Returns false if the block is malformed.
+    bool load(const block_header_t& header, const uint8_t* payload);
+
+    // Decode the next packet in the block. Returns false if the block is exhausted. Exits if the
+    // block is malformed.
+    bool next(packet_t& packet);
+};
+
+// Input of a trace. Regular files are memory-mapped and read in place. Other files, such as pipes
+// and standard input (path "-"), are read through a buffer.
+class TraceInput {
+private:
+    // Used if the file is memory-mapped
+    const uint8_t* map = nullptr;
+    size_t size = 0;
+    size_t pos = 0;
+
+    // Used if the file is streamed. Bytes in [pos, size) of the buffer are yet to be read.
+    FILE* stream = nullptr;
+    std::vector<uint8_t> buffer;
+
+    // Make sure at least count bytes are available. Returns false at end of file.
+    bool fill(size_t count);
+
+public:
+    TraceInput(const char* path);
+    ~TraceInput();
+
+    // Return a pointer to the next count bytes without consuming them, or nullptr if there are not
+    // as many bytes left.
+    const uint8_t* peek(size_t count) {
+        if (map) return size - pos >= count ? map + pos : nullptr;
+        return fill(count) ? buffer.data() + pos : nullptr;
+    }
+
+    // Consume the next count bytes and return a pointer to them, or nullptr if there are not as
+    // many bytes left. The pointer is valid until the next call.
+    const uint8_t* read(size_t count) {
+        auto ptr = peek(count);
+        if (ptr) pos += count;
+        return ptr;
+    }
+};
+
+}
+
+#endif // TLBSIM_TRACE_H
@@ -7,18 +7,86 @@
 #define TLBSIM_UTIL_H
 
 #include <atomic>
+#include <cstddef>
+#include <cstdint>
 
 namespace tlbsim {
 
+static constexpr size_t CACHE_LINE_SIZE = 64;
+
+// Hint to the processor that we are in a spin-wait loop.
+static inline void cpu_relax() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// Test-and-test-and-set lock with exponential backoff.
 class Spinlock {
-    std::atomic_flag flag = ATOMIC_FLAG_INIT;
+    static constexpr unsigned MAX_BACKOFF = 1024;
+    std::atomic<bool> flag {false};
 public:
-    void lock() {
-        while (flag.test_and_set(std::memory_order_acquire));
+    // Writers and readers both need to acquire the lock.
+    static constexpr bool optimistic_read = false;
+
+    // Returns the number of backoff rounds spent waiting for another holder, 0 if uncontended.
+    unsigned lock() noexcept {
+        unsigned spins = 0;
+        unsigned backoff = 1;
+        while (flag.exchange(true, std::memory_order_acquire)) {
+            // Only retry the exchange when the lock looks free, so waiters share the cache line
+            // instead of taking it exclusively in turns.
+            do {
+                for (unsigned i = 0; i < backoff; i++) cpu_relax();
+                if (backoff < MAX_BACKOFF) backoff <<= 1;
+                spins++;
+            } while (flag.load(std::memory_order_relaxed));
+        }
+        return spins;
+    }
+
+    void unlock() noexcept {
+        flag.store(false, std::memory_order_release);
+    }
+};
+
+// Sequence lock for read-mostly data. Writers are serialised with a spinlock, and readers never
+// write to the lock; they instead retry if a writer has interleaved with them. Data read inside a
+// read section may be torn and must only be used after read_retry returns false.
+class SeqLock {
+    std::atomic<uint32_t> seq {0};
+    Spinlock writer;
+public:
+    static constexpr bool optimistic_read = true;
+
+    unsigned lock() noexcept {
+        unsigned spins = writer.lock();
+        seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        return spins;
+    }
+
+    void unlock() noexcept {
+        seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        writer.unlock();
+    }
+
+    // Start a read section. The number of rounds waited for a writer is added to spins.
+    uint32_t read_begin(unsigned& spins) const noexcept {
+        uint32_t value;
+        while ((value = seq.load(std::memory_order_acquire)) & 1) {
+            cpu_relax();
+            spins++;
+        }
+        return value;
     }
 
-    void unlock() {
-        flag.clear(std::memory_order_release);
+    // Returns true if the read section started by read_begin needs to be retried.
+    bool read_retry(uint32_t value) const noexcept {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return seq.load(std::memory_order_relaxed) != value;
     }
 };
 
@@ -8,6 +8,7 @@
 #ifndef TLBSIM_VALIDATOR_H
 #define TLBSIM_VALIDATOR_H
 
+#include <cstddef>
 #include <unordered_map>
 #include "tlb.h"
 #include "util.h"
@@ -39,6 +40,11 @@ public:
     }
 
     int access(tlb_entry_t &search, const tlbsim_req_t& req) override;
+
+    // Requests are validated one by one.
+    void access_batch(tlb_entry_t* searches, const tlbsim_req_t* reqs, int* perms, size_t count) override {
+        TLB::access_batch(searches, reqs, perms, count);
+    }
 };
 
 }
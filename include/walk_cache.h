@@ -0,0 +1,82 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ * Copyright (c) 2019, Gary Guo
+ *
+ * This header defines the page walk cache, which holds non-leaf PTEs so that page walks can skip
+ * the upper levels of the page table.
+ */
+
+#ifndef TLBSIM_WALK_CACHE_H
+#define TLBSIM_WALK_CACHE_H
+
+#include <vector>
+
+#include "tlb.h"
+#include "stats.h"
+
+namespace tlbsim {
+
+// A private page walk cache of a hart. A non-leaf PTE at level L (level 0 being the leaf) is keyed
+// by the root PPN of the page table, the ASID, and the VPN bits above level L. The cache is either
+// unified, or split into one cache per level with the same geometry. Each cache is set-associative
+// and FIFO-replaced.
+// Only the hart itself walks and flushes, so no locking is needed.
+class WalkCache {
+public:
+    // Highest level of non-leaf PTEs, which is the root of Sv48.
+    static constexpr int MAX_LEVEL = 3;
+
+private:
+    struct entry_t {
+        // VPN bits above the level, shifted left by 2 and ORed with the level. 0 if invalid.
+        uint64_t tag;
+        uint64_t root;
+        uint64_t pte;
+        // Global if the PTE or any PTE above it is global.
+        asid_t asid;
+    };
+
+    struct cache_t {
+        tlb_stats_t* stats;
+        int idx_bits;
+        int assoc;
+        std::vector<entry_t> entries;
+        // Next way to replace of each set.
+        std::vector<int> ptrs;
+
+        cache_t(tlb_stats_t* stats, int size, int assoc);
+        entry_t* set(uint64_t tag);
+    };
+
+    // A single cache if unified, otherwise caches of levels 1 to MAX_LEVEL.
+    std::vector<cache_t> caches;
+
+    cache_t& cache(int level) { return caches[caches.size() == 1 ? 0 : level - 1]; }
+
+    static uint64_t make_tag(uint64_t vpn, int level) {
+        return (vpn >> (level * 9)) << 2 | level;
+    }
+
+public:
+    // stats has an element per cache, i.e. one if unified, or MAX_LEVEL if split.
+    WalkCache(const std::vector<tlb_stats_t*>& stats, int size, int assoc);
+
+    // Find the lowest cached non-leaf PTE on the walk of vpn, below level levels. Returns its level,
+    // or 0 if none is cached. If found, the PTE is stored in pte, and asid is made global if the
+    // PTE is under a global mapping.
+    int find(asid_t& asid, uint64_t root, uint64_t vpn, int levels, uint64_t& pte);
+
+    // Insert a non-leaf PTE at level. A miss is counted, as this is called for each PTE the walk
+    // needed but did not find in the cache.
+    void insert(asid_t asid, uint64_t root, uint64_t vpn, int level, uint64_t pte);
+
+    // Flush entries in the same way as TLBs. A flush with a VPN removes all entries on its walk.
+    void flush(asid_t asid, uint64_t vpn);
+};
+
+// Page walk caches of each hart. nullptr if there is none.
+extern WalkCache* config_pwcs[MAX_HARTS];
+
+}
+
+#endif // TLBSIM_WALK_CACHE_H
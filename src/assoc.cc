@@ -0,0 +1,82 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ * Copyright (c) 2019, Gary Guo
+ */
+
+#include "assoc.h"
+
+namespace tlbsim {
+
+Generations::context_t* Generations::context_slow(int32_t key) {
+    lock.lock();
+    auto ptr = context_map.find(key);
+    context_t* context;
+    if (ptr) {
+        context = *ptr;
+    } else {
+        asid_t asid = key;
+        auto realm_ptr = realm_map.find(asid.realm());
+        realm_t* realm;
+        if (realm_ptr) {
+            realm = *realm_ptr;
+        } else {
+            realm = &realms.emplace_back();
+            realm_map.insert_or_assign(asid.realm(), realm);
+        }
+        context = &contexts.emplace_back();
+        context->realm = realm;
+        realm->contexts.push_back(context);
+        context_map.insert_or_assign(key, context);
+    }
+    lock.unlock();
+    return context;
+}
+
+// A flush marks the context or realm as flushed before it takes the count. If the count is taken
+// while it is being updated, the update fails and finds the entry stale when it is retried.
+void Generations::count(context_t* context, uint64_t epoch, int32_t delta) noexcept {
+    uint64_t value = context->live.load(std::memory_order_acquire);
+    uint64_t next;
+    do {
+        if (stale(context, epoch)) return;
+        next = (value & ~0xffffffffULL) | (uint32_t)((uint32_t)value + delta);
+    } while (!context->live.compare_exchange_weak(
+        value, next, std::memory_order_relaxed, std::memory_order_acquire
+    ));
+}
+
+// Take the live entries of a context, which have become stale. Returns their number.
+uint64_t Generations::take(context_t* context) noexcept {
+    uint64_t value = context->live.load(std::memory_order_relaxed);
+    while (!context->live.compare_exchange_weak(
+        value, ((value >> 32) + 1) << 32, std::memory_order_release, std::memory_order_relaxed
+    ));
+    return (uint32_t)value;
+}
+
+uint64_t Generations::flush(asid_t asid) {
+    lock.lock();
+    uint64_t num_flush = 0;
+    uint64_t next = epoch.load(std::memory_order_relaxed) + 1;
+    if (asid.global()) {
+        auto ptr = realm_map.find(asid.realm());
+        if (ptr) {
+            auto& realm = **ptr;
+            realm.flushed.store(next, std::memory_order_relaxed);
+            for (auto context: realm.contexts) num_flush += take(context);
+            epoch.store(next, std::memory_order_release);
+        }
+    } else {
+        auto ptr = context_map.find(key(asid));
+        if (ptr) {
+            auto context = *ptr;
+            context->flushed.store(next, std::memory_order_relaxed);
+            num_flush = take(context);
+            epoch.store(next, std::memory_order_release);
+        }
+    }
+    lock.unlock();
+    return num_flush;
+}
+
+}
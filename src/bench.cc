@@ -0,0 +1,391 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ * Copyright (c) 2019, Gary Guo
+ *
+ * Benchmarks of the simulator without a guest. A synthetic client provides Sv39 and Sv48 page
+ * tables in a host buffer. As the library reads its configuration when it is loaded, each benchmark
+ * runs in a child process which loads the library with its own configuration.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "api.h"
+#include "config.h"
+#include "pgtable.h"
+
+using namespace tlbsim;
+
+//
+// Synthetic client
+//
+
+// Physical memory of the client, which holds page tables only.
+static constexpr uint64_t MEM_BASE = 0x80000000;
+static constexpr size_t MEM_PAGES = 4096;
+static uint64_t memory[MEM_PAGES * 512];
+static size_t next_page;
+
+static uint64_t phys_load(tlbsim_client_t* self, uint64_t addr) {
+    return __atomic_load_n(&memory[(addr - MEM_BASE) / 8], __ATOMIC_RELAXED);
+}
+
+static bool phys_cmpxchg(tlbsim_client_t* self, uint64_t addr, uint64_t old, uint64_t value) {
+    return __atomic_compare_exchange_n(
+        &memory[(addr - MEM_BASE) / 8], &old, value, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED
+    );
+}
+
+static void* phys_map(tlbsim_client_t* self, uint64_t ppn) {
+    return &memory[((ppn << 12) - MEM_BASE) / 8];
+}
+
+// There is no L0 TLB to invalidate.
+static void invalidate_l0(tlbsim_client_t* self, int hartid, uint64_t vpn, int type) {}
+
+static void invalidate_l0_batch(tlbsim_client_t* self, int hartid, const uint64_t* vpns, size_t count, int type) {}
+
+__attribute__((visibility("default")))
+tlbsim_client_t tlbsim_client = { phys_load, phys_cmpxchg, invalidate_l0, phys_map, invalidate_l0_batch };
+
+static uint64_t alloc_page() {
+    if (next_page == MEM_PAGES) {
+        fprintf(stderr, "Bench: Out of page table memory\n");
+        exit(1);
+    }
+    return (MEM_BASE >> 12) + next_page++;
+}
+
+// Map a 4K page in the page table rooted at root with the given number of levels.
+static void map(uint64_t root, int levels, uint64_t vpn, uint64_t ppn, uint64_t flags) {
+    uint64_t table = root;
+    for (int i = levels - 1; i > 0; i--) {
+        auto& pte = memory[((table << 12) - MEM_BASE) / 8 + ((vpn >> (i * 9)) & 0x1ff)];
+        if (!(pte & PTE_V)) pte = alloc_page() << 10 | PTE_V;
+        table = pte >> 10;
+    }
+    memory[((table << 12) - MEM_BASE) / 8 + (vpn & 0x1ff)] = ppn << 10 | flags | PTE_V;
+}
+
+// User pages start at USER_VPN, and all accesses of benchmarks are to user pages.
+static constexpr uint64_t USER_VPN = 0x10000;
+static constexpr uint64_t MAX_USER_PAGES = 1 << 18;
+// Global kernel pages are at the top of the address space, which is the same for Sv39 and Sv48.
+static constexpr uint64_t KERNEL_VPN = (1ULL << 52) - 512;
+static constexpr uint64_t KERNEL_PAGES = 512;
+
+static uint64_t roots[2];
+
+static void setup_page_tables() {
+    for (int sv48 = 0; sv48 < 2; sv48++) {
+        int levels = sv48 ? 4 : 3;
+        uint64_t root = roots[sv48] = alloc_page();
+        for (uint64_t i = 0; i < MAX_USER_PAGES; i++) {
+            map(root, levels, USER_VPN + i, 0x100000 + i, PTE_R | PTE_W | PTE_U | PTE_A | PTE_D);
+        }
+        for (uint64_t i = 0; i < KERNEL_PAGES; i++) {
+            map(root, levels, KERNEL_VPN + i, 0x80000 + i, PTE_R | PTE_W | PTE_X | PTE_G | PTE_A | PTE_D);
+        }
+    }
+}
+
+//
+// Benchmarks
+//
+
+struct scenario_t {
+    std::string name;
+    std::string config;
+    // Number of harts, each run by its own thread.
+    int harts;
+    // Number of distinct pages each hart accesses, in random order.
+    uint64_t pages;
+    bool sv48;
+    // Total number of accesses or flushes timed.
+    uint64_t count;
+    // If non-negative, flushes of the variant are timed instead of accesses.
+    int flush;
+    // Whether page walks go through phys_load instead of host pointers.
+    bool no_map = false;
+    // If non-zero, accesses are made through tlbsim_access_batch with batches of this size.
+    size_t batch = 0;
+};
+
+enum {
+    FLUSH_FULL,
+    FLUSH_ASID,
+    FLUSH_PAGE,
+    FLUSH_GPAGE,
+};
+
+static const char* const BASE_CONFIG = R"({
+    "stlb": [{"type": "set", "size": 1024, "assoc": 8}],
+    "itlb": [{"type": "assoc", "size": 32}],
+    "dtlb": [{"type": "assoc", "size": 32}]
+})";
+
+static const char* const PWC_CONFIG = R"({
+    "stlb": [{"type": "set", "size": 1024, "assoc": 8}],
+    "itlb": [{"type": "assoc", "size": 32}],
+    "dtlb": [{"type": "assoc", "size": 32}],
+    "pwc": {"size": 32, "assoc": 4}
+})";
+
+static std::vector<scenario_t> make_scenarios() {
+    std::vector<scenario_t> scenarios;
+
+    // Hot paths. The working set fits in L1, fits in STLB, and fits in neither.
+    scenarios.push_back({"l1-hit", BASE_CONFIG, 1, 16, false, 1 << 24, -1});
+    scenarios.push_back({"stlb-hit", BASE_CONFIG, 1, 512, false, 1 << 22, -1});
+    scenarios.push_back({"walk-sv39", BASE_CONFIG, 1, MAX_USER_PAGES, false, 1 << 21, -1});
+    scenarios.push_back({"walk-sv48", BASE_CONFIG, 1, MAX_USER_PAGES, true, 1 << 21, -1});
+    scenarios.push_back({"walk-sv39-load", BASE_CONFIG, 1, MAX_USER_PAGES, false, 1 << 21, -1, true});
+    scenarios.push_back({"walk-sv48-load", BASE_CONFIG, 1, MAX_USER_PAGES, true, 1 << 21, -1, true});
+    scenarios.push_back({"walk-sv39-pwc", PWC_CONFIG, 1, MAX_USER_PAGES, false, 1 << 21, -1});
+    scenarios.push_back({"walk-sv48-pwc", PWC_CONFIG, 1, MAX_USER_PAGES, true, 1 << 21, -1});
+    scenarios.push_back({"l1-hit-batch", BASE_CONFIG, 1, 16, false, 1 << 24, -1, false, 16});
+    scenarios.push_back({"stlb-hit-batch", BASE_CONFIG, 1, 512, false, 1 << 22, -1, false, 16});
+    scenarios.push_back({"walk-sv39-batch", BASE_CONFIG, 1, MAX_USER_PAGES, false, 1 << 21, -1, false, 16});
+
+    // Flushes, each followed by accesses to bring flushed entries back.
+    scenarios.push_back({"flush-full", BASE_CONFIG, 1, 512, false, 1 << 12, FLUSH_FULL});
+    scenarios.push_back({"flush-asid", BASE_CONFIG, 1, 512, false, 1 << 12, FLUSH_ASID});
+    scenarios.push_back({"flush-page", BASE_CONFIG, 1, 512, false, 1 << 18, FLUSH_PAGE});
+    scenarios.push_back({"flush-gpage", BASE_CONFIG, 1, 512, false, 1 << 18, FLUSH_GPAGE});
+
+    // Each type as the shared TLB, with a working set larger than L1.
+    std::pair<const char*, const char*> types[] = {
+        {"assoc", R"([{"type": "assoc", "size": 1024}])"},
+        {"set", R"([{"type": "set", "size": 1024, "assoc": 8}])"},
+        {"set-seqlock", R"([{"type": "set", "size": 1024, "assoc": 8, "lock": "seqlock"}])"},
+        {"set-padded", R"([{"type": "set", "size": 1024, "assoc": 8, "padded": true}])"},
+        {"ideal", R"([{"type": "ideal"}])"},
+        {"validate", R"([{"type": "validate"}])"},
+        {"log", R"([{"type": "log", "file": "/dev/null"}])"},
+        {"mrc", R"([{"type": "mrc"}, {"type": "set", "size": 1024, "assoc": 8}])"},
+    };
+    for (auto& type: types) {
+        std::string config = std::string(R"({"stlb": )") + type.second +
+            R"(, "itlb": [{"type": "assoc", "size": 32}], "dtlb": [{"type": "assoc", "size": 32}]})";
+        scenarios.push_back({std::string("type-") + type.first, config, 1, 2048, false, 1 << 22, -1});
+    }
+    scenarios.push_back({"type-isolate", R"({
+        "stlb": [{"type": "set", "size": 1024, "assoc": 8}],
+        "ctlb": [{"type": "isolate"}],
+        "itlb": [{"type": "assoc", "size": 32}],
+        "dtlb": [{"type": "assoc", "size": 32}]
+    })", 1, 2048, false, 1 << 22, -1});
+
+    // Scaling of the shared TLB with the number of harts. The total number of accesses is fixed.
+    for (auto lock: {"spin", "seqlock"}) {
+        std::string config = std::string(R"({
+            "stlb": [{"type": "set", "size": 1024, "assoc": 8, "lock": ")") + lock + R"("}],
+            "itlb": [{"type": "assoc", "size": 32}],
+            "dtlb": [{"type": "assoc", "size": 32}]
+        })";
+        for (int harts = 1; harts <= MAX_HARTS; harts *= 2) {
+            scenarios.push_back({
+                std::string("scale-") + lock + "-" + std::to_string(harts),
+                config, harts, 256, false, 1 << 22, -1
+            });
+        }
+    }
+    return scenarios;
+}
+
+static tlbsim_resp_t (*access_fn)(tlbsim_req_t*);
+static void (*access_batch_fn)(tlbsim_req_t*, tlbsim_resp_t*, size_t);
+static void (*flush_fn)(int, int, uint64_t);
+
+// Number of random page indices a hart cycles through.
+static constexpr size_t SEQUENCE = 1 << 16;
+
+struct hart_t {
+    tlbsim_req_t req {};
+    std::vector<uint64_t> vpns;
+};
+
+static void setup_hart(hart_t& hart, const scenario_t& scenario, int hartid) {
+    // Each hart has its own ASID but shares the page table.
+    hart.req.asid = hartid + 1;
+    hart.req.hartid = hartid;
+    hart.req.satp =
+        (scenario.sv48 ? SATP_MODE_SV48 : SATP_MODE_SV39) | (uint64_t)hart.req.asid << 44 |
+        roots[scenario.sv48];
+    std::mt19937_64 rng(hartid);
+    hart.vpns.resize(SEQUENCE);
+    for (auto& vpn: hart.vpns) vpn = USER_VPN + rng() % scenario.pages;
+}
+
+static void run_batches(hart_t& hart, uint64_t count, size_t batch) {
+    std::vector<tlbsim_req_t> reqs(batch, hart.req);
+    std::vector<tlbsim_resp_t> resps(batch);
+    for (uint64_t i = 0; i < count; i += batch) {
+        for (size_t j = 0; j < batch; j++) {
+            reqs[j].asid = hart.req.asid;
+            reqs[j].vpn = hart.vpns[(i + j) & (SEQUENCE - 1)];
+        }
+        access_batch_fn(reqs.data(), resps.data(), batch);
+    }
+}
+
+static void run_accesses(hart_t& hart, uint64_t count, size_t batch) {
+    if (batch) return run_batches(hart, count, batch);
+    auto& req = hart.req;
+    for (uint64_t i = 0; i < count; i++) {
+        req.vpn = hart.vpns[i & (SEQUENCE - 1)];
+        access_fn(&req);
+    }
+}
+
+// Run a scenario, and return the number of nanoseconds per access or flush.
+static double run(const scenario_t& scenario) {
+    if (scenario.no_map) tlbsim_client.phys_map = nullptr;
+    setup_page_tables();
+    std::vector<hart_t> harts(scenario.harts);
+    for (int i = 0; i < scenario.harts; i++) setup_hart(harts[i], scenario, i);
+
+    auto start = std::chrono::steady_clock::now();
+    if (scenario.flush < 0) {
+        // Warm up TLBs first. Each round creates its own threads, which is negligible compared to
+        // the accesses.
+        for (bool timed: {false, true}) {
+            if (timed) start = std::chrono::steady_clock::now();
+            uint64_t count = timed ? scenario.count / scenario.harts : SEQUENCE;
+            std::vector<std::thread> threads;
+            for (auto& hart: harts) threads.emplace_back(run_accesses, std::ref(hart), count, scenario.batch);
+            for (auto& thread: threads) thread.join();
+        }
+        double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        return elapsed / scenario.count * scenario.harts;
+    }
+
+    // Page flushes are timed in batches of distinct pages, and other flushes one at a time.
+    auto& hart = harts[0];
+    auto& req = hart.req;
+    bool page = scenario.flush == FLUSH_PAGE || scenario.flush == FLUSH_GPAGE;
+    uint64_t batch = page ? std::min<uint64_t>(64, scenario.pages) : 1;
+    double elapsed = 0;
+    run_accesses(hart, SEQUENCE, 0);
+    for (uint64_t done = 0; done < scenario.count; done += batch) {
+        uint64_t first = USER_VPN + done % scenario.pages;
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < batch; i++) {
+            uint64_t vpn = USER_VPN + (first - USER_VPN + i) % scenario.pages;
+            switch (scenario.flush) {
+                case FLUSH_FULL: flush_fn(req.hartid, -1, 0); break;
+                case FLUSH_ASID: flush_fn(req.hartid, req.asid, 0); break;
+                case FLUSH_PAGE: flush_fn(req.hartid, req.asid, vpn); break;
+                case FLUSH_GPAGE: flush_fn(req.hartid, -1, vpn); break;
+            }
+        }
+        elapsed += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+        // Bring flushed entries back.
+        if (page) {
+            for (uint64_t i = 0; i < batch; i++) {
+                req.vpn = USER_VPN + (first - USER_VPN + i) % scenario.pages;
+                access_fn(&req);
+            }
+        } else {
+            for (uint64_t i = 0; i < scenario.pages; i++) {
+                req.vpn = USER_VPN + i;
+                access_fn(&req);
+            }
+        }
+    }
+    return elapsed / scenario.count;
+}
+
+// Load the library next to the executable, with configuration in the file config.
+static void load_library(const char* config) {
+    setenv("TLB_CONFIG", config, 1);
+    char path[4096];
+    ssize_t size = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (size < 0) size = 0;
+    path[size] = 0;
+    std::string lib = path;
+    lib = lib.substr(0, lib.rfind('/') + 1) + "libtlbsim.so";
+    void* handle = dlopen(lib.c_str(), RTLD_NOW | RTLD_GLOBAL);
+    if (!handle) {
+        fprintf(stderr, "Bench: %s\n", dlerror());
+        exit(1);
+    }
+    access_fn = reinterpret_cast<decltype(access_fn)>(dlsym(handle, "tlbsim_access"));
+    access_batch_fn = reinterpret_cast<decltype(access_batch_fn)>(dlsym(handle, "tlbsim_access_batch"));
+    flush_fn = reinterpret_cast<decltype(flush_fn)>(dlsym(handle, "tlbsim_flush"));
+}
+
+int main(int argc, char* argv[]) {
+    bool verbose = false;
+    const char* filter = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) verbose = true;
+        else filter = argv[i];
+    }
+
+    auto scenarios = make_scenarios();
+    printf("%-20s %6s %12s %14s\n", "Benchmark", "Harts", "ns/op", "Mops/s");
+    fflush(stdout);
+    for (auto& scenario: scenarios) {
+        if (filter && !strstr(scenario.name.c_str(), filter)) continue;
+
+        char config[] = "/tmp/tlbsim-bench-XXXXXX";
+        int fd = mkstemp(config);
+        if (fd < 0 || write(fd, scenario.config.data(), scenario.config.size()) != (ssize_t)scenario.config.size()) {
+            fprintf(stderr, "Bench: Cannot write configuration\n");
+            return 1;
+        }
+        close(fd);
+
+        // The result is sent back through a pipe, as statistics printed at exit go to stdout and
+        // stderr of the child.
+        int fds[2];
+        if (pipe(fds) != 0) return 1;
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fds[0]);
+            if (!verbose) {
+                int null = open("/dev/null", O_WRONLY);
+                dup2(null, STDOUT_FILENO);
+                dup2(null, STDERR_FILENO);
+            }
+            load_library(config);
+            double ns = run(scenario);
+            if (write(fds[1], &ns, sizeof(ns)) != sizeof(ns)) return 1;
+            close(fds[1]);
+            return 0;
+        }
+        close(fds[1]);
+        double ns;
+        bool ok = read(fds[0], &ns, sizeof(ns)) == sizeof(ns);
+        close(fds[0]);
+        int status;
+        waitpid(pid, &status, 0);
+        unlink(config);
+
+        if (!ok || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            printf("%-20s %6d %12s\n", scenario.name.c_str(), scenario.harts, "failed");
+        } else {
+            printf(
+                "%-20s %6d %12.2lf %14.2lf\n",
+                scenario.name.c_str(), scenario.harts, ns, 1e3 / ns * scenario.harts
+            );
+        }
+        fflush(stdout);
+    }
+    return 0;
+}
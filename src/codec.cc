@@ -0,0 +1,122 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ * Copyright (c) 2019, Gary Guo
+ *
+ * The compressed stream is a sequence of commands. Each command starts with a token byte, whose
+ * high nibble is the number of literals and low nibble is the match length minus MIN_MATCH. A
+ * nibble of 15 is followed by extension bytes which are added to it, until a byte that is not 255.
+ * The literals follow, and then a 16-bit little endian offset of the match. The last command has
+ * literals only.
+ */
+
+#include <cstring>
+
+#include "codec.h"
+
+namespace tlbsim {
+
+static constexpr size_t MIN_MATCH = 4;
+static constexpr size_t MAX_OFFSET = 65535;
+static constexpr int HASH_BITS = 12;
+
+static inline uint32_t load32(const uint8_t* ptr) {
+    uint32_t value;
+    memcpy(&value, ptr, 4);
+    return value;
+}
+
+static inline uint8_t* write_length(uint8_t* op, size_t length) {
+    for (; length >= 255; length -= 255) *op++ = 255;
+    *op++ = length;
+    return op;
+}
+
+static inline uint8_t* write_literals(uint8_t* op, const uint8_t* literals, size_t count, int match) {
+    *op++ = (count >= 15 ? 15 : count) << 4 | match;
+    if (count >= 15) op = write_length(op, count - 15);
+    memcpy(op, literals, count);
+    return op + count;
+}
+
+size_t lz_compress(const uint8_t* src, size_t size, uint8_t* dst) {
+    uint32_t table[1 << HASH_BITS] = {};
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    const uint8_t* end = src + size;
+    uint8_t* op = dst;
+
+    while (end - ip >= (ptrdiff_t)MIN_MATCH) {
+        uint32_t seq = load32(ip);
+        uint32_t hash = (seq * 2654435761u) >> (32 - HASH_BITS);
+        const uint8_t* ref = src + table[hash];
+        table[hash] = ip - src;
+        if (ref >= ip || (size_t)(ip - ref) > MAX_OFFSET || load32(ref) != seq) {
+            ip++;
+            continue;
+        }
+
+        const uint8_t* match_end = ip + MIN_MATCH;
+        const uint8_t* ref_end = ref + MIN_MATCH;
+        while (match_end < end && *match_end == *ref_end) match_end++, ref_end++;
+
+        size_t length = match_end - ip - MIN_MATCH;
+        op = write_literals(op, anchor, ip - anchor, length >= 15 ? 15 : length);
+        size_t offset = ip - ref;
+        *op++ = offset;
+        *op++ = offset >> 8;
+        if (length >= 15) op = write_length(op, length - 15);
+        ip = anchor = match_end;
+    }
+
+    op = write_literals(op, anchor, end - anchor, 0);
+    return op - dst;
+}
+
+static inline bool read_length(const uint8_t*& ip, const uint8_t* end, size_t& length) {
+    while (true) {
+        if (ip == end) return false;
+        uint8_t byte = *ip++;
+        length += byte;
+        if (byte != 255) return true;
+    }
+}
+
+bool lz_decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t raw_size) {
+    const uint8_t* ip = src;
+    const uint8_t* end = src + size;
+    uint8_t* op = dst;
+    uint8_t* out_end = dst + raw_size;
+
+    while (ip != end) {
+        uint8_t token = *ip++;
+        size_t count = token >> 4;
+        if (count == 15 && !read_length(ip, end, count)) return false;
+        if (count > (size_t)(end - ip) || count > (size_t)(out_end - op)) return false;
+        memcpy(op, ip, count);
+        ip += count;
+        op += count;
+
+        // Last command
+        if (ip == end) break;
+
+        if (end - ip < 2) return false;
+        size_t offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        size_t length = token & 15;
+        if (length == 15 && !read_length(ip, end, length)) return false;
+        length += MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - dst) || length > (size_t)(out_end - op)) return false;
+
+        const uint8_t* ref = op - offset;
+        if (offset >= length) {
+            memcpy(op, ref, length);
+        } else {
+            // Overlapping match, which repeats the last offset bytes.
+            for (size_t i = 0; i < length; i++) op[i] = ref[i];
+        }
+        op += length;
+    }
+    return op == out_end;
+}
+
+}
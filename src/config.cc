@@ -3,6 +3,7 @@
  * Copyright (c) 2019, Gary Guo
  */
 
+#include <cstring>
 #include <stdexcept>
 #include <fstream>
 #include <iostream>
@@ -17,25 +18,49 @@
 #include "ideal.h"
 #include "validator.h"
 #include "offline.h"
+#include "report.h"
+#include "sampler.h"
+#include "mrc.h"
+#include "walk_cache.h"
 
 namespace tlbsim {
 
 bool config_cache_inv = false;
 bool config_update_pte = true;
 TLB* config_stlb;
-TLB* config_ctlbs[32];
-TLB* config_itlbs[32];
-TLB* config_dtlbs[32];
+TLB* config_ctlbs[MAX_HARTS];
+TLB* config_itlbs[MAX_HARTS];
+TLB* config_dtlbs[MAX_HARTS];
 LogReplayer* config_replayer;
+std::vector<sweep_point_t> config_sweep;
+int config_sweep_threads;
+std::vector<LruAnalysis*> config_analysis;
+std::string config_analysis_file;
+Sampler* config_sampler;
 
 static Json::Value itlb_template;
 static Json::Value dtlb_template;
 static Json::Value ctlb_template;
 
+// Statistics of each configured level, shared by instances of all harts.
+static std::vector<tlb_stats_t*> itlb_stats;
+static std::vector<tlb_stats_t*> dtlb_stats;
+static std::vector<tlb_stats_t*> ctlb_stats;
+
+// Geometry of page walk caches, and statistics of each of their levels. pwc_stats is empty if there
+// is no page walk cache.
+static int pwc_size;
+static int pwc_assoc;
+static std::vector<tlb_stats_t*> pwc_stats;
+
 class HartIsolator: public TLB {
     int hartid;
 public:
-    HartIsolator(TLB* shared, int hartid): TLB(shared, nullptr, -1), hartid(hartid) {}
+    // The isolator is transparent, so entries spilled into it go to the shared TLB if it is
+    // exclusive.
+    HartIsolator(TLB* shared, int hartid): TLB(shared, nullptr, -1), hartid(hartid) {
+        inclusion = shared->inclusion;
+    }
 
     int access(tlb_entry_t &search, const tlbsim_req_t& req) {
         search.asid = (int32_t)search.asid | (hartid << 16);
@@ -44,10 +69,30 @@ public:
         return perm;
     }
 
+    void access_batch(tlb_entry_t* searches, const tlbsim_req_t* reqs, int* perms, size_t count) override {
+        for (size_t i = 0; i < count; i++) searches[i].asid = (int32_t)searches[i].asid | (hartid << 16);
+        parent->access_batch(searches, reqs, perms, count);
+        for (size_t i = 0; i < count; i++) searches[i].asid = (int32_t)searches[i].asid & 0xc000ffff;
+    }
+
+    bool insert(const tlb_entry_t& entry) override {
+        tlb_entry_t shared = entry;
+        shared.asid = (int32_t)shared.asid | (hartid << 16);
+        return parent->insert(shared);
+    }
+
     void flush(asid_t asid, uint64_t vpn) override {
         asid = asid | (hartid << 16);
         parent->flush(asid, vpn);
     }
+
+    // Only entries of the realm of the hart are held above.
+    void back_invalidate(const tlb_entry_t& entry) override {
+        if (entry.asid.realm() != hartid) return;
+        tlb_entry_t private_entry = entry;
+        private_entry.asid = (int32_t)private_entry.asid & 0xc000ffff;
+        TLB::back_invalidate(private_entry);
+    }
 };
 
 static Json::Value read_json(const char *path) {
@@ -66,20 +111,59 @@ static Json::Value read_json(const char *path) {
     return json;
 }
 
-// Verify the validity of the template, and print out the configuration
-static void validate_template(Json::Value& tmpl, bool shared) {
+static void validate_lock(Json::Value& tmpl) {
+    auto lock = tmpl.get("lock", "spin").asString();
+    if (lock != "spin" && lock != "seqlock") {
+        fprintf(stderr, "TLBSim: %s is not an accepted lock type\n", lock.c_str());
+        exit(1);
+    }
+    fprintf(stderr, "    lock: %s\n", lock.c_str());
+}
+
+// First levels are accessed directly by harts, rather than on misses of a level above, so they
+// cannot be exclusive. Inv levels are the first private levels, which are inclusive by default to
+// keep the L0 TLB inclusive.
+static void validate_inclusion(Json::Value& tmpl, bool first, bool inv) {
+    auto inclusion = tmpl.get("inclusion", inv ? "inclusive" : "non-inclusive").asString();
+    if (inclusion != "non-inclusive" && inclusion != "inclusive" && inclusion != "exclusive") {
+        fprintf(stderr, "TLBSim: %s is not an accepted inclusion policy\n", inclusion.c_str());
+        exit(1);
+    }
+    if (first && inclusion == "exclusive") {
+        fprintf(stderr, "TLBSim: First level of a hierarchy cannot be exclusive\n");
+        exit(1);
+    }
+    fprintf(stderr, "    inclusion: %s\n", inclusion.c_str());
+}
+
+static inclusion_t parse_inclusion(const Json::Value& tmpl, bool inv) {
+    auto inclusion = tmpl.get("inclusion", inv ? "inclusive" : "non-inclusive").asString();
+    if (inclusion == "inclusive") return inclusion_t::INCLUSIVE;
+    if (inclusion == "exclusive") return inclusion_t::EXCLUSIVE;
+    return inclusion_t::NON_INCLUSIVE;
+}
+
+// Verify the validity of the template, and print out the configuration. See validate_inclusion
+// for first and inv.
+static void validate_template(Json::Value& tmpl, bool shared, bool first, bool inv) {
     auto type = tmpl["type"].asString();
     fprintf(stderr, "  - type: %s\n", type.c_str());
     if (type == "assoc") {
         int size = tmpl["size"].asInt();
         fprintf(stderr, "    size: %d\n", size);
+        validate_lock(tmpl);
+        validate_inclusion(tmpl, first, inv);
         return;
     }
     if (type == "set") {
         int assoc = tmpl.get("assoc", 8).asInt();
         int size = tmpl["size"].asInt();
+        bool padded = tmpl.get("padded", false).asBool();
         fprintf(stderr, "    assoc: %d\n", assoc);
         fprintf(stderr, "    size: %d\n", size);
+        validate_lock(tmpl);
+        fprintf(stderr, "    padded: %s\n", padded ? "true" : "false");
+        validate_inclusion(tmpl, first, inv);
         return;
     }
     if (type == "isolate") {
@@ -90,6 +174,7 @@ static void validate_template(Json::Value& tmpl, bool shared) {
         return;
     }
     if (type == "ideal") {
+        validate_inclusion(tmpl, first, inv);
         return;
     }
     if (type == "validate") {
@@ -101,23 +186,94 @@ static void validate_template(Json::Value& tmpl, bool shared) {
             exit(1);
         }
         const char* file = tmpl["file"].asCString();
+        int format = tmpl.get("format", 2).asInt();
+        bool compress = tmpl.get("compress", true).asBool();
+        if (format != 1 && format != 2) {
+            fprintf(stderr, "TLBSim: %d is not an accepted trace format\n", format);
+            exit(1);
+        }
         fprintf(stderr, "    file: %s\n", file);
+        fprintf(stderr, "    format: %d\n", format);
+        if (format == 2) fprintf(stderr, "    compress: %s\n", compress ? "true" : "false");
+        return;
+    }
+    if (type == "mrc") {
+        double rate = tmpl.get("rate", 0.01).asDouble();
+        uint64_t max_entries = tmpl.get("max_entries", 8192).asUInt64();
+        uint64_t max_size = tmpl.get("max_size", 65536).asUInt64();
+        if (rate <= 0 || rate > 1) {
+            fprintf(stderr, "TLBSim: Sampling rate must be within (0, 1]\n");
+            exit(1);
+        }
+        if (max_entries == 0 || max_size == 0) {
+            fprintf(stderr, "TLBSim: max_entries and max_size must be non-zero\n");
+            exit(1);
+        }
+        fprintf(stderr, "    rate: %lg\n", rate);
+        fprintf(stderr, "    max_entries: %lu\n", max_entries);
+        fprintf(stderr, "    max_size: %lu\n", max_size);
         return;
     }
     fprintf(stderr, "TLBSim: %s is not an accepted TLB type\n", type.c_str());
     exit(1);
 }
 
-static TLB* instantiate(const Json::Value& tmpl, TLB* parent, tlb_stats_t* stats, int hartid, bool inv) {
+// Common geometries are specialised at compile time so that the way loop can be unrolled. Other
+// geometries fall back to runtime-sized sets.
+template<typename Lock>
+static TLB* instantiate_assoc(TLB* parent, tlb_stats_t* stats, int hartid, int size) {
+    switch (size) {
+        case 16: return new AssocTLB<FIFOSet<16>, Lock>(parent, stats, hartid, size);
+        case 32: return new AssocTLB<FIFOSet<32>, Lock>(parent, stats, hartid, size);
+        case 64: return new AssocTLB<FIFOSet<64>, Lock>(parent, stats, hartid, size);
+    }
+    return new AssocTLB<FIFOSet<>, Lock>(parent, stats, hartid, size);
+}
+
+template<typename Lock, bool Padded>
+static TLB* instantiate_set(TLB* parent, tlb_stats_t* stats, int hartid, int size, int assoc) {
+#define SET_ASSOC(SIZE, ASSOC) \
+    if (size == SIZE && assoc == ASSOC) \
+        return new SetAssocTLB<FIFOSet<ASSOC>, SIZE / ASSOC, Lock, Padded>(parent, stats, hartid, size, assoc);
+
+    SET_ASSOC(128, 4)
+    SET_ASSOC(128, 8)
+    SET_ASSOC(512, 4)
+    SET_ASSOC(512, 8)
+    SET_ASSOC(512, 16)
+    SET_ASSOC(1024, 4)
+    SET_ASSOC(1024, 8)
+    SET_ASSOC(1024, 16)
+    SET_ASSOC(2048, 4)
+    SET_ASSOC(2048, 8)
+    SET_ASSOC(2048, 16)
+#undef SET_ASSOC
+
+    return new SetAssocTLB<FIFOSet<>, 0, Lock, Padded>(parent, stats, hartid, size, assoc);
+}
+
+// The configuration file as read, which is recorded in traces.
+static std::string config_text;
+
+static TLB* instantiate_level(const Json::Value& tmpl, TLB* parent, tlb_stats_t* stats, int hartid, bool inv) {
     auto type = tmpl["type"].asString();
     if (type == "assoc") {
         int size = tmpl["size"].asInt();
-        return new AssocTLB<>(parent, stats, inv ? hartid : -1, size);
+        bool seqlock = tmpl.get("lock", "spin").asString() == "seqlock";
+        return (seqlock ? instantiate_assoc<SeqLock> : instantiate_assoc<Spinlock>)(
+            parent, stats, -1, size
+        );
     }
     if (type == "set") {
         int assoc = tmpl.get("assoc", 8).asInt();
         int size = tmpl["size"].asInt();
-        return new SetAssocTLB<>(parent, stats, inv ? hartid : -1, size, assoc);
+        bool seqlock = tmpl.get("lock", "spin").asString() == "seqlock";
+        bool padded = tmpl.get("padded", false).asBool();
+        auto instantiate_set_with =
+            seqlock ?
+                (padded ? instantiate_set<SeqLock, true> : instantiate_set<SeqLock, false>) :
+                (padded ? instantiate_set<Spinlock, true> : instantiate_set<Spinlock, false>);
+        return instantiate_set_with(parent, stats, -1, size, assoc);
     }
     if (type == "isolate") {
         return new HartIsolator(parent, hartid);
@@ -130,16 +286,166 @@ static TLB* instantiate(const Json::Value& tmpl, TLB* parent, tlb_stats_t* stats
     }
     if (type == "log") {
         const char* file = tmpl["file"].asCString();
-        return new AccessLogger(parent, std::ofstream(file));
+        int format = tmpl.get("format", 2).asInt();
+        bool compress = tmpl.get("compress", true).asBool();
+        return new AccessLogger(parent, std::ofstream(file, std::ios::binary), format, compress, config_text);
+    }
+    if (type == "mrc") {
+        double rate = tmpl.get("rate", 0.01).asDouble();
+        uint64_t max_entries = tmpl.get("max_entries", 8192).asUInt64();
+        uint64_t max_size = tmpl.get("max_size", 65536).asUInt64();
+        return new MrcTLB(parent, stats, rate, max_entries, max_size);
     }
     // Not reachable
     return nullptr;
 }
 
+// Instantiate a level, and register it with its parent so an inclusive parent can reach it.
+static TLB* instantiate(const Json::Value& tmpl, TLB* parent, tlb_stats_t* stats, int hartid, bool inv) {
+    TLB* tlb = instantiate_level(tmpl, parent, stats, hartid, inv);
+    auto type = tmpl["type"].asString();
+    if (type == "assoc" || type == "set" || type == "ideal") {
+        // Only an inclusive first private level keeps the L0 TLB inclusive.
+        tlb->inclusion = parse_inclusion(tmpl, inv);
+        tlb->hartid = inv && tlb->inclusion == inclusion_t::INCLUSIVE ? hartid : -1;
+    }
+    parent->add_child(tlb);
+    return tlb;
+}
+
+// Build a stlb hierarchy for each combination of values of swept parameters. Each key of sweep is
+// a parameter in the form of "stlb.<level>.<parameter>" (or just "<parameter>" for stlb.0), and
+// each value is an array of values to take.
+static void setup_sweep(const Json::Value& sweep, const Json::Value& stlb_template) {
+    if (!config_replayer) {
+        fprintf(stderr, "TLBSim: Sweep can only be used when replaying\n");
+        exit(1);
+    }
+
+    std::vector<Json::Value> templates { stlb_template };
+    std::vector<std::string> labels { "" };
+    for (auto& name: sweep.getMemberNames()) {
+        std::string key = name.find('.') == std::string::npos ? "stlb.0." + name : name;
+        unsigned level;
+        int offset = 0;
+        if (
+            sscanf(key.c_str(), "stlb.%u.%n", &level, &offset) != 1 || offset == 0 ||
+            level >= stlb_template.size()
+        ) {
+            fprintf(stderr, "TLBSim: %s is not an accepted sweep parameter\n", name.c_str());
+            exit(1);
+        }
+        std::string param = key.substr(offset);
+        auto& values = sweep[name];
+        if (!values.isArray() || values.empty()) {
+            fprintf(stderr, "TLBSim: Values of sweep parameter %s must be a non-empty array\n", name.c_str());
+            exit(1);
+        }
+
+        std::vector<Json::Value> new_templates;
+        std::vector<std::string> new_labels;
+        for (size_t i = 0; i < templates.size(); i++) {
+            for (auto& value: values) {
+                Json::Value tmpl = templates[i];
+                tmpl[level][param] = value;
+                new_templates.push_back(tmpl);
+                std::string text = value.isString() ? value.asString() : value.toStyledString();
+                if (text.back() == '\n') text.pop_back();
+                new_labels.push_back(labels[i] + (labels[i].empty() ? "" : " ") + key + '=' + text);
+            }
+        }
+        templates.swap(new_templates);
+        labels.swap(new_labels);
+    }
+
+    fprintf(stderr, "  sweep:\n");
+    for (size_t i = 0; i < templates.size(); i++) {
+        auto& tmpl = templates[i];
+        fprintf(stderr, "  - %s\n", labels[i].c_str());
+        for (int j = tmpl.size() - 1; j >= 0; j--) {
+            validate_template(tmpl[j], true, j == 0, false);
+        }
+
+        sweep_point_t point;
+        point.label = labels[i];
+        point.terminal = new ReplayTerminal();
+        point.stlb = point.terminal;
+        for (Json::ArrayIndex j = 0; j < tmpl.size(); j++) {
+            point.stats.push_back(add_tlb_level("stlb", j, tmpl[j], i));
+        }
+        for (int j = tmpl.size() - 1; j >= 0; j--) {
+            point.stlb = instantiate(tmpl[j], point.stlb, point.stats[j], -1, false);
+        }
+        config_sweep.push_back(point);
+    }
+}
+
+// Set up LRU miss ratio curve analysis for each number of sets, with sizes up to max_size.
+static void setup_analysis(const Json::Value& analysis) {
+    if (!config_replayer) {
+        fprintf(stderr, "TLBSim: Analysis can only be used when replaying\n");
+        exit(1);
+    }
+    if (!config_sweep.empty()) {
+        fprintf(stderr, "TLBSim: Analysis and sweep cannot be used together\n");
+        exit(1);
+    }
+
+    Json::Value sets = analysis["sets"];
+    if (sets.isNull()) sets.append(1);
+    uint64_t max_size = analysis.get("max_size", 65536).asUInt64();
+    if (!sets.isArray() || sets.empty()) {
+        fprintf(stderr, "TLBSim: Numbers of sets to analyse must be a non-empty array\n");
+        exit(1);
+    }
+    fprintf(stderr, "  analysis:\n");
+    fprintf(stderr, "    sets: [");
+    for (Json::ArrayIndex i = 0; i < sets.size(); i++) {
+        int num = sets[i].asInt();
+        if (num <= 0 || (num & (num - 1)) || (uint64_t)num > max_size) {
+            fprintf(stderr, "\nTLBSim: Number of sets %d is not a power of two within max_size\n", num);
+            exit(1);
+        }
+        fprintf(stderr, i == 0 ? "%d" : ", %d", num);
+        config_analysis.push_back(new LruAnalysis(num, max_size / num));
+    }
+    fprintf(stderr, "]\n");
+    fprintf(stderr, "    max_size: %lu\n", max_size);
+    auto& file = analysis["file"];
+    if (file.isString()) {
+        config_analysis_file = file.asString();
+        fprintf(stderr, "    file: %s\n", config_analysis_file.c_str());
+    }
+}
+
+// Set up page walk caches, which are instantiated for each hart along with private TLBs.
+static void setup_pwc(const Json::Value& pwc) {
+    if (config_replayer) {
+        fprintf(stderr, "TLBSim: Page walk cache cannot be used when replaying\n");
+        exit(1);
+    }
+    pwc_size = pwc.get("size", 32).asInt();
+    pwc_assoc = pwc.get("assoc", pwc_size).asInt();
+    bool split = pwc.get("split", false).asBool();
+    int sets = pwc_assoc > 0 ? pwc_size / pwc_assoc : 0;
+    if (pwc_size <= 0 || pwc_assoc <= 0 || pwc_size % pwc_assoc || (sets & (sets - 1))) {
+        fprintf(stderr, "TLBSim: Page walk cache needs a power-of-two number of sets\n");
+        exit(1);
+    }
+    fprintf(stderr, "  pwc:\n");
+    fprintf(stderr, "    size: %d\n", pwc_size);
+    fprintf(stderr, "    assoc: %d\n", pwc_assoc);
+    fprintf(stderr, "    split: %s\n", split ? "true" : "false");
+    for (int i = 0; i < (split ? WalkCache::MAX_LEVEL : 1); i++) {
+        pwc_stats.push_back(add_tlb_level("pwc", i, pwc));
+    }
+}
+
 __attribute__((constructor))
 static void setup_env2(void) {
     char *config_file = getenv("TLB_CONFIG");
     Json::Value config_json = read_json(config_file ? config_file : "tlbsim.config");
+    config_text = Json::writeString(Json::StreamWriterBuilder(), config_json);
     fprintf(stderr, "TLB Configuration:\n");
     tlbsim_need_instret = config_json.get("need_instret", true).asBool();
     fprintf(stderr, "  need_instret: %s\n", tlbsim_need_instret ? "true" : "false");
@@ -152,15 +458,71 @@ static void setup_env2(void) {
 
     auto& replay = config_json["replay"];
     if (replay.isString()) {
-        config_replayer = new LogReplayer(std::ifstream(replay.asCString()));
+        config_replayer = new LogReplayer(replay.asCString());
         fprintf(stderr, "  replay: \"%s\"\n", replay.asCString());
+        fprintf(stderr, "    version: %d\n", config_replayer->version());
+        if (config_replayer->version() == 2) fprintf(stderr, "    harts: %d\n", config_replayer->harts());
+    }
+
+    auto& stats_file = config_json["stats_file"];
+    if (stats_file.isString()) {
+        std::string file = stats_file.asString();
+        bool csv = file.size() >= 4 && file.compare(file.size() - 4, 4, ".csv") == 0;
+        std::string format = config_json.get("stats_format", csv ? "csv" : "json").asString();
+        if (format != "json" && format != "csv") {
+            fprintf(stderr, "TLBSim: %s is not an accepted statistics format\n", format.c_str());
+            exit(1);
+        }
+        set_stats_file(file, format);
+        fprintf(stderr, "  stats_file: \"%s\"\n", file.c_str());
+        fprintf(stderr, "  stats_format: %s\n", format.c_str());
+    }
+
+    auto& sample = config_json["sample"];
+    if (sample.isObject()) {
+        const char* file = sample["file"].asCString();
+        auto unit = sample.get("unit", "instret").asString();
+        uint64_t interval = sample.get("interval", 1000000).asUInt64();
+        uint64_t buffer = sample.get("buffer", 4096).asUInt64();
+        if (unit != "instret" && unit != "access") {
+            fprintf(stderr, "TLBSim: %s is not an accepted sampling unit\n", unit.c_str());
+            exit(1);
+        }
+        if (unit == "instret" && !tlbsim_need_instret) {
+            fprintf(stderr, "TLBSim: Sampling by instret requires need_instret\n");
+            exit(1);
+        }
+        if (interval == 0 || buffer == 0) {
+            fprintf(stderr, "TLBSim: Sampling interval and buffer must be non-zero\n");
+            exit(1);
+        }
+        FILE* fp = fopen(file, "w");
+        if (!fp) {
+            fprintf(stderr, "TLBSim: Cannot open %s\n", file);
+            exit(1);
+        }
+        config_sampler = new Sampler(fp, unit == "instret", interval, buffer);
+        fprintf(stderr, "  sample:\n");
+        fprintf(stderr, "    file: %s\n", file);
+        fprintf(stderr, "    unit: %s\n", unit.c_str());
+        fprintf(stderr, "    interval: %lu\n", interval);
+        fprintf(stderr, "    buffer: %lu\n", buffer);
     }
 
-    auto validate = [&config_json](Json::Value& tmpl, const char* key) {
-        tmpl.swap(config_json[key]);
-        if (!tmpl.isArray()) {
-            tmpl = Json::arrayValue;
+    Json::Value stlb_template;
+    for (auto [tmpl, key]: {
+        std::pair(&stlb_template, "stlb"), std::pair(&ctlb_template, "ctlb"),
+        std::pair(&itlb_template, "itlb"), std::pair(&dtlb_template, "dtlb")
+    }) {
+        tmpl->swap(config_json[key]);
+        if (!tmpl->isArray()) {
+            *tmpl = Json::arrayValue;
         }
+    }
+
+    // First and inv apply to the first level of the list, see validate_inclusion. A hart reaches
+    // ctlb (or stlb if there is no ctlb) directly when it has no I-TLB or D-TLB.
+    auto validate = [](Json::Value& tmpl, const char* key, std::vector<tlb_stats_t*>& stats, bool first, bool inv) {
         auto size = tmpl.size();
         if (size == 0) {
             fprintf(stderr, "  %s: []\n", key);
@@ -168,42 +530,70 @@ static void setup_env2(void) {
             fprintf(stderr, "  %s:\n", key);
             auto size = tmpl.size();
             for (int i = size - 1; i >= 0; i--) {
-                validate_template(tmpl[i], false);
+                validate_template(tmpl[i], strcmp(key, "stlb") == 0, i == 0 && first, i == 0 && inv);
             }
         }
+        for (Json::ArrayIndex i = 0; i < size; i++) {
+            stats.push_back(add_tlb_level(key, i, tmpl[i]));
+        }
     };
 
-    Json::Value stlb_template;
-    validate(stlb_template, "stlb");
-    validate(ctlb_template, "ctlb");
-    validate(itlb_template, "itlb");
-    validate(dtlb_template, "dtlb");
+    bool unsplit = itlb_template.empty() || dtlb_template.empty();
+    std::vector<tlb_stats_t*> stlb_stats;
+    validate(stlb_template, "stlb", stlb_stats, config_replayer || (ctlb_template.empty() && unsplit), false);
+    validate(ctlb_template, "ctlb", ctlb_stats, unsplit, itlb_template.empty() && dtlb_template.empty());
+    validate(itlb_template, "itlb", itlb_stats, true, true);
+    validate(dtlb_template, "dtlb", dtlb_stats, true, true);
 
     // Instantiate shared eagerly
     config_stlb = config_replayer ? (TLB*)config_replayer : &page_walker;
     auto size = stlb_template.size();
     for (int i = size - 1; i >= 0; i--) {
-        config_stlb = instantiate(stlb_template[i], config_stlb, &stlb_stats, -1, false);
+        config_stlb = instantiate(stlb_template[i], config_stlb, stlb_stats[i], -1, false);
+    }
+
+    auto& sweep = config_json["sweep"];
+    if (sweep.isObject()) {
+        setup_sweep(sweep, stlb_template);
+        config_sweep_threads = config_json.get("sweep_threads", 0).asInt();
+        fprintf(stderr, "  sweep_threads: %d\n", config_sweep_threads);
     }
+
+    auto& analysis = config_json["analysis"];
+    if (analysis.isObject()) {
+        setup_analysis(analysis);
+    }
+
+    auto& pwc = config_json["pwc"];
+    if (pwc.isObject()) {
+        setup_pwc(pwc);
+    }
+
+    // All levels are known now, so the sampler can start.
+    if (config_sampler) config_sampler->start();
 }
 
 void setup_private_tlb(int hartid) {
+    if (!pwc_stats.empty()) {
+        config_pwcs[hartid] = new WalkCache(pwc_stats, pwc_size, pwc_assoc);
+    }
+
     TLB *ctlb = config_stlb;
     auto size = ctlb_template.size();
     for (int i = size - 1; i >= 0; i--) {
-        ctlb = instantiate(ctlb_template[i], ctlb, &ctlb_stats, hartid, i == 0 && itlb_template.empty() && dtlb_template.empty());
+        ctlb = instantiate(ctlb_template[i], ctlb, ctlb_stats[i], hartid, i == 0 && itlb_template.empty() && dtlb_template.empty());
     }
 
     TLB *itlb = ctlb;
     size = itlb_template.size();
     for (int i = size - 1; i >= 0; i--) {
-        itlb = instantiate(itlb_template[i], itlb, &itlb_stats, hartid, i == 0);
+        itlb = instantiate(itlb_template[i], itlb, itlb_stats[i], hartid, i == 0);
     }
 
     TLB *dtlb = ctlb;
     size = dtlb_template.size();
     for (int i = size - 1; i >= 0; i--) {
-        dtlb = instantiate(dtlb_template[i], dtlb, &dtlb_stats, hartid, i == 0);
+        dtlb = instantiate(dtlb_template[i], dtlb, dtlb_stats[i], hartid, i == 0);
     }
 
     config_ctlbs[hartid] = ctlb;
@@ -0,0 +1,125 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ * Copyright (c) 2019, Gary Guo
+ *
+ * This file defines lookup kernels for associative sets and selects one at runtime.
+ */
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "lookup.h"
+
+namespace tlbsim {
+
+// Scalar matching of ways starting from `begin`. This is always inlined so that the tail of SIMD
+// kernels is compiled for the same target; calling into code of another target with dirty upper
+// vector state incurs heavy AVX-SSE transition penalties.
+__attribute__((always_inline))
+static inline lookup_result_t lookup_range(const uint64_t* vpns, const int32_t* asids, int begin,
+                                           int size, uint64_t vpn, asid_t asid, int free) {
+    for (int i = begin; i < size; i++) {
+        if (vpns[i] == INVALID_VPN) {
+            if (free == -1) free = i;
+            continue;
+        }
+        if (vpns[i] != vpn) continue;
+        if (!asid_t(asids[i]).match(asid)) continue;
+        return {i, free};
+    }
+    return {-1, free};
+}
+
+static lookup_result_t lookup_scalar(const uint64_t* vpns, const int32_t* asids, int size,
+                                     uint64_t vpn, asid_t asid) {
+    return lookup_range(vpns, asids, 0, size, vpn, asid, -1);
+}
+
+#if defined(__x86_64__)
+
+// The ASID words are matched as follows: XOR the entry with the searched ASID, and check that
+// all bits within the mask are zero. Realm is always included in the mask, and ASID bits are
+// only included for non-global entries. The global bit of each entry is broadcasted by an
+// arithmetic shift to build the per-way mask.
+
+__attribute__((target("sse4.1")))
+static lookup_result_t lookup_sse4(const uint64_t* vpns, const int32_t* asids, int size,
+                                   uint64_t vpn, asid_t asid) {
+    const __m128i v_vpn = _mm_set1_epi64x(vpn);
+    const __m128i v_inv = _mm_set1_epi64x(INVALID_VPN);
+    const __m128i v_asid = _mm_set1_epi32(asid.realm_asid());
+    const __m128i v_full = _mm_set1_epi32(0x3fffffff);
+    const __m128i v_low = _mm_set1_epi32(0xffff);
+    int free = -1;
+    int i = 0;
+    for (; i + 2 <= size; i += 2) {
+        __m128i tags = _mm_loadu_si128(reinterpret_cast<const __m128i*>(vpns + i));
+        __m128i words = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(asids + i));
+        __m128i mask = _mm_andnot_si128(_mm_and_si128(_mm_srai_epi32(words, 31), v_low), v_full);
+        __m128i asid_eq = _mm_cmpeq_epi32(
+            _mm_and_si128(_mm_xor_si128(words, v_asid), mask), _mm_setzero_si128()
+        );
+        __m128i eq = _mm_and_si128(_mm_cmpeq_epi64(tags, v_vpn), _mm_cvtepi32_epi64(asid_eq));
+        int hit = _mm_movemask_pd(_mm_castsi128_pd(eq));
+        if (hit) return {i + __builtin_ctz(hit), free};
+        if (free == -1) {
+            int empty = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(tags, v_inv)));
+            if (empty) free = i + __builtin_ctz(empty);
+        }
+    }
+    return lookup_range(vpns, asids, i, size, vpn, asid, free);
+}
+
+__attribute__((target("avx2")))
+static lookup_result_t lookup_avx2(const uint64_t* vpns, const int32_t* asids, int size,
+                                   uint64_t vpn, asid_t asid) {
+    const __m256i v_vpn = _mm256_set1_epi64x(vpn);
+    const __m256i v_inv = _mm256_set1_epi64x(INVALID_VPN);
+    const __m128i v_asid = _mm_set1_epi32(asid.realm_asid());
+    const __m128i v_full = _mm_set1_epi32(0x3fffffff);
+    const __m128i v_low = _mm_set1_epi32(0xffff);
+    int free = -1;
+    int i = 0;
+    for (; i + 4 <= size; i += 4) {
+        __m256i tags = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(vpns + i));
+        __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(asids + i));
+        __m128i mask = _mm_andnot_si128(_mm_and_si128(_mm_srai_epi32(words, 31), v_low), v_full);
+        __m128i asid_eq = _mm_cmpeq_epi32(
+            _mm_and_si128(_mm_xor_si128(words, v_asid), mask), _mm_setzero_si128()
+        );
+        __m256i eq = _mm256_and_si256(
+            _mm256_cmpeq_epi64(tags, v_vpn), _mm256_cvtepi32_epi64(asid_eq)
+        );
+        int hit = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+        if (hit) return {i + __builtin_ctz(hit), free};
+        if (free == -1) {
+            int empty = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(tags, v_inv)));
+            if (empty) free = i + __builtin_ctz(empty);
+        }
+    }
+    return lookup_range(vpns, asids, i, size, vpn, asid, free);
+}
+
+#endif
+
+static lookup_kernel_t select_lookup_kernel() {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        lookup_kernel_name = "avx2";
+        return lookup_avx2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        lookup_kernel_name = "sse4";
+        return lookup_sse4;
+    }
+#endif
+    lookup_kernel_name = "scalar";
+    return lookup_scalar;
+}
+
+const char* lookup_kernel_name;
+lookup_kernel_t lookup_kernel = select_lookup_kernel();
+
+}
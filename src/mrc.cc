@@ -0,0 +1,331 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ * Copyright (c) 2019, Gary Guo
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+#include "mrc.h"
+#include "assoc.h"
+#include "config.h"
+#include "offline.h"
+#include "report.h"
+#include "stats.h"
+
+namespace tlbsim {
+
+// Number of times available initially, which is also the minimum after renumbering.
+static constexpr size_t MIN_TIMES = 64;
+
+LruStack::LruStack(): tree(MIN_TIMES + 1), keys(MIN_TIMES + 1) {}
+
+void LruStack::add(uint64_t time, int delta) {
+    for (; time < tree.size(); time += time & -time) tree[time] += delta;
+}
+
+uint64_t LruStack::prefix(uint64_t time) const {
+    uint64_t sum = 0;
+    for (; time; time -= time & -time) sum += tree[time];
+    return sum;
+}
+
+void LruStack::punch(key_t key, uint64_t time) {
+    times.erase(key);
+    keys[time] = HOLE;
+    holes.push(time);
+}
+
+void LruStack::renumber() {
+    // Keep at least half of the times free, so renumbering is amortised over as many accesses as
+    // there are entries.
+    size_t capacity = depth * 2;
+    if (capacity < MIN_TIMES) capacity = MIN_TIMES;
+    std::vector<key_t> old_keys(capacity + 1);
+    old_keys.swap(keys);
+    tree.assign(capacity + 1, 0);
+    std::vector<uint64_t> hole_times;
+
+    uint64_t old_now = now;
+    now = 0;
+    for (uint64_t time = 1; time <= old_now; time++) {
+        key_t key = old_keys[time];
+        if (key == HOLE) {
+            hole_times.push_back(++now);
+        } else {
+            // Skip entries which have been used again or removed since.
+            auto current = times.find(key);
+            if (!current || *current != time) continue;
+            *current = ++now;
+        }
+        keys[now] = key;
+        tree[now] = 1;
+    }
+    holes = std::priority_queue<uint64_t>(std::less<uint64_t>(), std::move(hole_times));
+
+    // Build the Fenwick tree in place.
+    for (size_t i = 1; i <= capacity; i++) {
+        size_t parent = i + (i & -i);
+        if (parent <= capacity) tree[parent] += tree[i];
+    }
+}
+
+uint64_t LruStack::access(asid_t asid, uint64_t vpn, const tlb_entry_t& entry, bool insert) {
+    asid.global(false);
+    key_t key = make_key(asid, vpn);
+    asid.global(true);
+    key_t global_key = make_key(asid, vpn);
+
+    // A translation may match both a global and a non-global entry, in which case the most
+    // recently used one is taken.
+    auto time = times.find(key);
+    auto global_time = times.find(global_key);
+    if (global_time && (!time || *global_time > *time)) {
+        key = global_key;
+        time = global_time;
+    }
+
+    uint64_t found = time ? *time : 0;
+    uint64_t distance = found ? depth - prefix(found) + 1 : 0;
+    if (!insert) return distance;
+
+    // Another entry for the same translation is replaced, which leaves a hole.
+    key_t new_key = make_key(entry.asid, entry.vpn);
+    if (new_key != key) {
+        if (auto existing = times.find(new_key)) punch(new_key, *existing);
+    }
+
+    if (!holes.empty() && holes.top() > found) {
+        // TLBs holding the topmost hole but not the entry take the entry into the hole without
+        // eviction, and those holding both lose the entry from its old place. So the hole moves
+        // to where the entry was.
+        uint64_t hole = holes.top();
+        holes.pop();
+        add(hole, -1);
+        keys[hole] = 0;
+        depth--;
+        if (found) punch(key, found);
+    } else if (found) {
+        add(found, -1);
+        times.erase(key);
+        depth--;
+    }
+
+    if (now == keys.size() - 1) renumber();
+    times.insert_or_assign(new_key, ++now);
+    keys[now] = new_key;
+    add(now, 1);
+    depth++;
+    return distance;
+}
+
+void LruStack::flush(asid_t asid, uint64_t vpn) {
+    if (vpn != 0 && !asid.global()) {
+        // Only the non-global entry of the page with the ASID matches.
+        key_t key = make_key(asid, vpn);
+        if (auto time = times.find(key)) punch(key, *time);
+        return;
+    }
+    times.erase_if([&](key_t key, uint64_t time) {
+        if (vpn != 0 && (uint64_t)(key >> 32) != vpn) return false;
+        if (!asid_t((int32_t)key).match_flush(asid)) return false;
+        keys[time] = HOLE;
+        holes.push(time);
+        return true;
+    });
+}
+
+LruAnalysis::LruAnalysis(int sets, size_t max_assoc):
+    idx_bits{ilog2(sets)}, stacks(sets), distances(max_assoc + 2), sets{sets}, max_assoc{max_assoc} {}
+
+void LruAnalysis::access(const tlbsim_req_t& req, const tlb_entry_t& entry, bool insert) {
+    auto& stack = stacks[set_index(req.asid, req.vpn, idx_bits)];
+    uint64_t distance = stack.access(req.asid, req.vpn, entry, insert);
+    distances[distance <= max_assoc ? distance : max_assoc + 1]++;
+}
+
+void LruAnalysis::flush(asid_t asid, uint64_t vpn) {
+    if (vpn == 0) {
+        for (auto& stack: stacks) stack.flush(asid, 0);
+    } else {
+        stacks[set_index(asid, vpn, idx_bits)].flush(asid, vpn);
+    }
+}
+
+uint64_t LruAnalysis::misses(size_t assoc) const {
+    uint64_t sum = distances[0];
+    for (size_t i = assoc + 1; i < distances.size(); i++) sum += distances[i];
+    return sum;
+}
+
+static std::atomic<MrcTLB*> mrc_tlbs {nullptr};
+
+MrcTLB::MrcTLB(TLB* parent, tlb_stats_t* stats, double rate, size_t max_entries, size_t max_size):
+    TLB(parent, stats, -1), max_entries{max_entries}, max_size{max_size}, distances(max_size + 2) {
+
+    uint32_t threshold = rate * (1 << SAMPLE_BITS);
+    this->threshold.store(threshold ? threshold : 1, std::memory_order_relaxed);
+    accesses = 0;
+
+    // Private levels are instantiated when harts first access them, possibly at the same time.
+    next_mrc = mrc_tlbs.load(std::memory_order_relaxed);
+    while (!mrc_tlbs.compare_exchange_weak(next_mrc, this, std::memory_order_release, std::memory_order_relaxed));
+}
+
+int MrcTLB::access(tlb_entry_t &search, const tlbsim_req_t& req) {
+    asid_t asid = search.asid;
+    uint64_t vpn = search.vpn;
+    int perm = parent->access(search, req);
+    ++accesses;
+
+    // Most accesses are not sampled, and they do not need the lock.
+    uint32_t hash = sample_hash(asid, vpn);
+    if (hash >= threshold.load(std::memory_order_relaxed)) return perm;
+
+    unsigned spins = lock.lock();
+    // The rate may have been lowered in the meantime.
+    uint32_t threshold = this->threshold.load(std::memory_order_relaxed);
+    if (hash < threshold) {
+        // Whether the translation is cached after a miss, as in TLB::access_impl.
+        bool insert = config_cache_inv || perm == 0;
+        uint64_t distance = stack.access(asid, vpn, search, insert);
+        double scale = (double)(1 << SAMPLE_BITS) / threshold;
+        size_t index = distance == 0 ? 0 : std::min<size_t>(llround(distance * scale), max_size + 1);
+        distances[index] += scale;
+
+        if (stack.size() > max_entries && threshold > 1) {
+            threshold /= 2;
+            this->threshold.store(threshold, std::memory_order_relaxed);
+            stack.erase_if([&](asid_t asid, uint64_t vpn) {
+                return sample_hash(asid, vpn) >= threshold;
+            });
+        }
+    }
+    lock.unlock();
+    if (spins) {
+        ++stats->contend;
+        stats->spin += spins;
+    }
+    return perm;
+}
+
+void MrcTLB::flush_local(asid_t asid, uint64_t vpn) {
+    if (vpn != 0 && sample_hash(asid, vpn) >= threshold.load(std::memory_order_relaxed)) return;
+    lock.lock();
+    stack.flush(asid, vpn);
+    lock.unlock();
+}
+
+void print_mrc_curves() {
+    for (auto level: tlb_levels()) {
+        uint64_t accesses = 0;
+        std::vector<double> distances;
+        uint32_t threshold = UINT32_MAX;
+        for (auto tlb = mrc_tlbs.load(std::memory_order_acquire); tlb; tlb = tlb->next_mrc) {
+            if (tlb->stats != &level->stats) continue;
+            tlb->lock.lock();
+            accesses += *tlb->accesses;
+            distances.resize(tlb->distances.size());
+            for (size_t i = 0; i < distances.size(); i++) distances[i] += tlb->distances[i];
+            threshold = std::min(threshold, tlb->threshold.load(std::memory_order_relaxed));
+            tlb->lock.unlock();
+        }
+        if (distances.empty()) continue;
+
+        // Miss ratios are taken among sampled accesses, which are then scaled to all accesses.
+        // The number of accesses estimated from samples may be off from the actual number if
+        // frequently accessed translations happen to be (or not be) sampled, and this affects
+        // all sizes alike.
+        double estimate = 0;
+        for (auto weight: distances) estimate += weight;
+        double hits = 0;
+
+        fprintf(stderr, "MRC %s:\n", level->name().c_str());
+        fprintf(stderr, "  Accesses: %ld\n", accesses);
+        fprintf(stderr, "  Rate    : %.3lg\n", (double)threshold / (1 << MrcTLB::SAMPLE_BITS));
+        fprintf(stderr, "  %8s %12s %10s\n", "Size", "Miss", "Miss ratio");
+        size_t max_size = distances.size() - 2;
+        for (size_t size = 1, i = 1; ; size *= 2) {
+            if (size > max_size) size = max_size;
+            for (; i <= size; i++) hits += distances[i];
+            double ratio = estimate ? 1 - hits / estimate : 0;
+            fprintf(stderr, "  %8ld %12.0lf %10.6lf\n", size, ratio * accesses, ratio);
+            if (size == max_size) break;
+        }
+    }
+}
+
+void reset_mrc_curves() {
+    for (auto tlb = mrc_tlbs.load(std::memory_order_acquire); tlb; tlb = tlb->next_mrc) {
+        tlb->lock.lock();
+        tlb->accesses = 0;
+        std::fill(tlb->distances.begin(), tlb->distances.end(), 0);
+        tlb->lock.unlock();
+    }
+}
+
+void replay_analysis(LogReplayer& replayer) {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t accesses = 0;
+    uint64_t flushes = 0;
+    while (auto packet = replayer.next()) {
+        if (packet->tag == packet_t::FLUSH) {
+            for (auto analysis: config_analysis) {
+                analysis->flush(packet->flush.asid, packet->flush.vpn);
+            }
+            flushes++;
+            continue;
+        }
+        auto& req = packet->access.req;
+        auto& entry = packet->access.search;
+        current_hart = req.hartid;
+        // Whether the translation is cached after a miss, as in TLB::access_impl.
+        bool insert = config_cache_inv || pte_permission_check(entry.pte, req) == 0;
+        for (auto analysis: config_analysis) analysis->access(req, entry, insert);
+        accesses++;
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    fprintf(stderr, "Analysis:\n");
+    fprintf(stderr, "  Accesses  : %ld\n", accesses);
+    fprintf(stderr, "  Flushes   : %ld\n", flushes);
+    fprintf(stderr, "  Time      : %lg\n", elapsed);
+    fprintf(stderr, "  Accesses/s: %lg\n", accesses / elapsed);
+
+    // Print associativities of powers of two, and the largest one.
+    for (auto analysis: config_analysis) {
+        fprintf(stderr, "LRU, %d sets:\n", analysis->sets);
+        fprintf(stderr, "  %8s %8s %12s %10s\n", "Size", "Assoc", "Miss", "Miss ratio");
+        for (size_t assoc = 1; ; assoc *= 2) {
+            if (assoc > analysis->max_assoc) assoc = analysis->max_assoc;
+            uint64_t misses = analysis->misses(assoc);
+            fprintf(
+                stderr, "  %8ld %8ld %12ld %10.6lf\n",
+                assoc * analysis->sets, assoc, misses, accesses ? (double)misses / accesses : 0.0
+            );
+            if (assoc == analysis->max_assoc) break;
+        }
+    }
+
+    if (!config_analysis_file.empty()) {
+        FILE* file = fopen(config_analysis_file.c_str(), "w");
+        if (!file) {
+            fprintf(stderr, "TLBSim: Cannot open %s\n", config_analysis_file.c_str());
+            exit(1);
+        }
+        fprintf(file, "sets,assoc,size,miss\n");
+        for (auto analysis: config_analysis) {
+            for (size_t assoc = 1; assoc <= analysis->max_assoc; assoc++) {
+                fprintf(
+                    file, "%d,%ld,%ld,%ld\n",
+                    analysis->sets, assoc, assoc * analysis->sets, analysis->misses(assoc)
+                );
+            }
+        }
+        fclose(file);
+    }
+}
+
+}
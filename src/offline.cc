@@ -4,72 +4,244 @@
  */
 
 #include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <condition_variable>
+#include <mutex>
 
 #include "offline.h"
+#include "stats.h"
 
 namespace tlbsim {
 
-struct packet_t {
-    union {
-        struct {
-            tlbsim_req_t req;
-            tlb_entry_t search;
-        } access;
-        struct {
-            asid_t asid;
-            uint64_t vpn;
-        } flush;
-    };
-    enum {
-        ACCESS,
-        FLUSH
-    } tag;
-};
+static AccessLogger* loggers;
+
+AccessLogger::AccessLogger(TLB* parent, std::ofstream&& os, int version, bool compress, const std::string& config):
+    TLB(parent, NULL, -1), os(std::move(os)), version{version}, encoder(compress) {
+
+    if (version == 2) {
+        trace_header_t header;
+        memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+        header.version = 2;
+        header.endian = TRACE_ENDIAN;
+        header.harts = 0;
+        header.flags = 0;
+        header.config_size = config.size();
+        this->os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        this->os.write(config.data(), config.size());
+    } else {
+        batch.reserve(BATCH_SIZE);
+    }
+
+    next_logger = loggers;
+    loggers = this;
+    writer = std::thread([this]() {
+        uint64_t next = 0;
+        while (true) {
+            // Harts have stopped logging before stopping is set, so if nothing is left after it
+            // is observed, we are done.
+            bool stop = stopping.load(std::memory_order_acquire);
+            if (drain(next)) continue;
+            if (stop) break;
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    });
+}
+
+void AccessLogger::log(const packet_t& packet) {
+    auto& slot = rings[current_hart];
+    ring_t* ring = slot.load(std::memory_order_relaxed);
+    if (!ring) {
+        ring = new ring_t;
+        slot.store(ring, std::memory_order_release);
+    }
+
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) == RING_SIZE) {
+        ring->stall++;
+        do {
+            ring->spin++;
+            std::this_thread::yield();
+        } while (head - ring->tail.load(std::memory_order_acquire) == RING_SIZE);
+    }
+
+    // The sequence number is only taken once there is space, so the writer can always make
+    // progress with the smallest sequence number outstanding.
+    auto& record = ring->records[head % RING_SIZE];
+    record.seq = seq.fetch_add(1, std::memory_order_relaxed);
+    record.instret = __atomic_load_n(&tlbsim_instret, __ATOMIC_RELAXED);
+    record.packet = packet;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+bool AccessLogger::drain(uint64_t& next) {
+    bool progress = false;
+    for (auto& slot: rings) {
+        ring_t* ring = slot.load(std::memory_order_acquire);
+        if (!ring) continue;
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t old_tail = tail;
+        for (; tail != head; tail++) {
+            auto& record = ring->records[tail % RING_SIZE];
+            if (record.seq != next) break;
+            write(record);
+            next++;
+        }
+        if (tail != old_tail) {
+            ring->tail.store(tail, std::memory_order_release);
+            progress = true;
+        }
+    }
+    return progress;
+}
+
+void AccessLogger::write(const record_t& record) {
+    auto& packet = record.packet;
+    if (packet.tag == packet_t::ACCESS && packet.access.req.hartid >= harts) {
+        harts = packet.access.req.hartid + 1;
+    }
+    if (version == 2) {
+        encoder.encode(packet, record.instret);
+        if (encoder.full()) {
+            encoder.flush(os);
+            writes++;
+        }
+    } else {
+        batch.push_back(packet);
+        if (batch.size() == BATCH_SIZE) write_pending();
+    }
+}
+
+void AccessLogger::write_pending() {
+    if (version == 2) {
+        encoder.flush(os);
+    } else {
+        if (batch.empty()) return;
+        os.write(reinterpret_cast<const char*>(batch.data()), batch.size() * sizeof(packet_t));
+        batch.clear();
+    }
+    writes++;
+}
 
 int AccessLogger::access(tlb_entry_t &search, const tlbsim_req_t& req) {
-    lock.lock();
     int ret = parent->access(search, req);
     packet_t packet;
     packet.access.req = req;
     packet.access.search = search;
     packet.tag = packet_t::ACCESS;
-    os.write(reinterpret_cast<const char*>(&packet), sizeof(packet_t));
-    lock.unlock();
+    log(packet);
     return ret;
 }
 
 void AccessLogger::flush(asid_t asid, uint64_t vpn) {
-    lock.lock();
     packet_t packet;
     packet.flush.asid = asid;
     packet.flush.vpn = vpn;
     packet.tag = packet_t::FLUSH;
-    os.write(reinterpret_cast<char*>(&packet), sizeof(packet_t));
-    lock.unlock();
+    log(packet);
+}
+
+void AccessLogger::stop() {
+    stopping.store(true, std::memory_order_release);
+    writer.join();
+    write_pending();
+    if (version == 2) {
+        // Now the number of harts is known.
+        os.seekp(offsetof(trace_header_t, harts));
+        os.write(reinterpret_cast<const char*>(&harts), sizeof(harts));
+    }
+    os.flush();
+
+    uint64_t stall = 0;
+    uint64_t spin = 0;
+    for (auto& slot: rings) {
+        ring_t* ring = slot.load(std::memory_order_acquire);
+        if (!ring) continue;
+        stall += ring->stall;
+        spin += ring->spin;
+    }
+    fprintf(stderr, "Access Log:\n");
+    fprintf(stderr, "  Packets: %ld\n", seq.load(std::memory_order_relaxed));
+    fprintf(stderr, "  Writes : %ld\n", writes);
+    fprintf(stderr, "  Stall  : %ld\n", stall);
+    fprintf(stderr, "  Spin   : %ld\n", spin);
+}
+
+void stop_access_loggers() {
+    for (auto logger = loggers; logger; logger = logger->next_logger) {
+        logger->stop();
+    }
 }
 
 int LogReplayer::access(tlb_entry_t &search, const tlbsim_req_t& req) {
-    assert(&req == &req_ut);
-    search = search_ut;
+    assert(&req == &current->access.req);
+    search = current->access.search;
     return pte_permission_check(search.pte, req);
 }
 
+LogReplayer::LogReplayer(const char* path): TLB(NULL, NULL, -1), input(path) {
+    auto ptr = input.peek(sizeof(trace_header_t));
+    if (ptr && memcmp(ptr, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0) {
+        memcpy(&header, input.read(sizeof(trace_header_t)), sizeof(trace_header_t));
+        if (header.version != 2 || header.endian != TRACE_ENDIAN) {
+            fprintf(stderr, "TLBSim: Unsupported trace version or endianness\n");
+            exit(1);
+        }
+        if (!input.read(header.config_size)) {
+            fprintf(stderr, "TLBSim: Malformed trace\n");
+            exit(1);
+        }
+        return;
+    }
+
+    // Version 1 traces have no header.
+    header.version = 1;
+    header.harts = 0;
+}
+
+const packet_t* LogReplayer::next() {
+    if (header.version == 1) {
+        return reinterpret_cast<const packet_t*>(input.read(sizeof(packet_t)));
+    }
+
+    while (!decoder.next(decoded)) {
+        // Block headers are not necessarily aligned, so copy them out.
+        block_header_t block;
+        auto ptr = input.read(sizeof(block));
+        if (!ptr) return nullptr;
+        memcpy(&block, ptr, sizeof(block));
+        // Uncompressed payloads are decoded in place.
+        auto payload = input.read(block.size);
+        if (!payload || !decoder.load(block, payload)) {
+            fprintf(stderr, "TLBSim: Malformed trace\n");
+            exit(1);
+        }
+        tlbsim_instret = block.instret;
+    }
+    return &decoded;
+}
+
 bool LogReplayer::replay_step(TLB* target) {
-    if (!is) return false;
-    packet_t packet;
-    if (!is.read(reinterpret_cast<char*>(&packet), sizeof(packet_t))) return false;
-    switch (packet.tag) {
+    auto packet = next();
+    if (!packet) return false;
+    switch (packet->tag) {
         case packet_t::ACCESS: {
-            req_ut = packet.access.req;
-            search_ut = packet.access.search;
+            current = packet;
+            auto& req = packet->access.req;
+            current_hart = req.hartid;
             tlb_entry_t entry;
-            entry.asid = req_ut.asid;
-            entry.vpn = req_ut.vpn;
-            target->access(entry, req_ut);
+            entry.asid = req.asid;
+            entry.vpn = req.vpn;
+            target->access(entry, req);
+            accesses++;
             break;
         }
         case packet_t::FLUSH: {
-            target->flush(packet.flush.asid, packet.flush.vpn);
+            target->flush(packet->flush.asid, packet->flush.vpn);
+            flushes++;
             break;
         }
         default: assert(0);
@@ -77,4 +249,123 @@ bool LogReplayer::replay_step(TLB* target) {
     return true;
 }
 
+int ReplayTerminal::access(tlb_entry_t &search, const tlbsim_req_t& req) {
+    search = current->access.search;
+    return pte_permission_check(search.pte, req);
+}
+
+// Packets are decoded once into chunks, which are shared by all workers.
+static constexpr size_t SWEEP_CHUNK_SIZE = 65536;
+static constexpr int SWEEP_CHUNKS = 3;
+
+static inline void replay_packet(sweep_point_t& point, const packet_t& packet) {
+    if (packet.tag == packet_t::FLUSH) {
+        point.stlb->flush(packet.flush.asid, packet.flush.vpn);
+        return;
+    }
+    auto& req = packet.access.req;
+    point.terminal->current = &packet;
+    current_hart = req.hartid;
+    tlb_entry_t entry;
+    entry.asid = req.asid;
+    entry.vpn = req.vpn;
+    point.stlb->access(entry, req);
+}
+
+void replay_sweep(LogReplayer& replayer) {
+    auto& points = config_sweep;
+    int threads = config_sweep_threads ? config_sweep_threads : std::thread::hardware_concurrency();
+    if (threads > (int)points.size()) threads = points.size();
+    if (threads < 1) threads = 1;
+
+    struct chunk_t {
+        std::vector<packet_t> packets;
+        // Number of workers yet to finish with the chunk.
+        int pending = 0;
+    };
+    chunk_t chunks[SWEEP_CHUNKS];
+    std::mutex mutex;
+    std::condition_variable cv;
+    // Number of chunks filled so far.
+    uint64_t produced = 0;
+    bool done = false;
+
+    auto start = std::chrono::steady_clock::now();
+
+    // Points are statically assigned to workers. Each worker replays a chunk into one point at a
+    // time, so the working set is that of a single hierarchy.
+    std::vector<std::thread> workers;
+    for (int id = 0; id < threads; id++) {
+        workers.emplace_back([&, id]() {
+            for (uint64_t n = 0; ; n++) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [&]() { return produced > n || done; });
+                    if (produced <= n) return;
+                }
+                auto& chunk = chunks[n % SWEEP_CHUNKS];
+                for (size_t i = id; i < points.size(); i += threads) {
+                    for (auto& packet: chunk.packets) replay_packet(points[i], packet);
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--chunk.pending == 0) cv.notify_all();
+            }
+        });
+    }
+
+    uint64_t accesses = 0;
+    uint64_t flushes = 0;
+    for (uint64_t n = 0; ; n++) {
+        auto& chunk = chunks[n % SWEEP_CHUNKS];
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&]() { return chunk.pending == 0; });
+        }
+
+        chunk.packets.clear();
+        while (chunk.packets.size() < SWEEP_CHUNK_SIZE) {
+            auto packet = replayer.next();
+            if (!packet) break;
+            if (packet->tag == packet_t::ACCESS) accesses++;
+            else flushes++;
+            chunk.packets.push_back(*packet);
+        }
+        bool last = chunk.packets.size() < SWEEP_CHUNK_SIZE;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!chunk.packets.empty()) {
+                chunk.pending = threads;
+                produced = n + 1;
+            }
+            done = last;
+        }
+        cv.notify_all();
+        if (last) break;
+    }
+    for (auto& worker: workers) worker.join();
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    fprintf(stderr, "Sweep:\n");
+    fprintf(stderr, "  Points    : %ld\n", points.size());
+    fprintf(stderr, "  Threads   : %d\n", threads);
+    fprintf(stderr, "  Accesses  : %ld\n", accesses);
+    fprintf(stderr, "  Flushes   : %ld\n", flushes);
+    fprintf(stderr, "  Time      : %lg\n", elapsed);
+    fprintf(stderr, "  Accesses/s: %lg\n", accesses * points.size() / elapsed);
+
+    for (size_t i = 0; i < points.size(); i++) {
+        auto& point = points[i];
+        fprintf(stderr, "Point %ld: %s\n", i, point.label.c_str());
+        fprintf(stderr, "  %-6s %12s %12s %12s\n", "Level", "Miss", "Eviction", "Flush");
+        for (size_t j = 0; j < point.stats.size(); j++) {
+            auto stats = point.stats[j];
+            fprintf(
+                stderr, "  stlb.%-1ld %12ld %12ld %12ld\n",
+                j, *stats->miss, *stats->evict, *stats->flush
+            );
+        }
+    }
+}
+
 }
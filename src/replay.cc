@@ -1,7 +1,10 @@
+#include <chrono>
+#include <cstdio>
 #include <iostream>
 #include "api.h"
 #include "config.h"
 #include "offline.h"
+#include "mrc.h"
 #include "stats.h"
 #include "assoc.h"
 
@@ -10,6 +13,24 @@ using namespace tlbsim;
 tlbsim_client_t tlbsim_client;
 
 int main(int argc, char *argv[]) {
+    if (!config_analysis.empty()) {
+        replay_analysis(*config_replayer);
+        return 0;
+    }
+
+    if (!config_sweep.empty()) {
+        replay_sweep(*config_replayer);
+        return 0;
+    }
+
+    auto start = std::chrono::steady_clock::now();
     while (config_replayer->replay_step(config_stlb)) {}
-}
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
+    uint64_t accesses = config_replayer->replayed_accesses();
+    fprintf(stderr, "Replay:\n");
+    fprintf(stderr, "  Accesses  : %ld\n", accesses);
+    fprintf(stderr, "  Flushes   : %ld\n", config_replayer->replayed_flushes());
+    fprintf(stderr, "  Time      : %lg\n", elapsed);
+    fprintf(stderr, "  Accesses/s: %lg\n", accesses / elapsed);
+}
@@ -0,0 +1,248 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ * Copyright (c) 2019, Gary Guo
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "api.h"
+#include "report.h"
+#include "util.h"
+
+namespace tlbsim {
+
+struct report_t {
+    std::vector<tlb_level_t*> levels;
+    std::string file;
+    std::string format;
+    // Snapshots are appended to the file as they are taken, so it is kept open.
+    int fd = -1;
+    // Size of the file after the last complete snapshot.
+    off_t size = 0;
+    uint64_t snapshots = 0;
+};
+
+// Counters are exported from a destructor, so keep the state alive until the very end instead of
+// relying on the order of static destructors.
+static report_t& report() {
+    static report_t* report = new report_t;
+    return *report;
+}
+
+std::string tlb_level_t::name() const {
+    std::string name = group + '.' + std::to_string(index);
+    if (point != -1) name = "sweep." + std::to_string(point) + '.' + name;
+    return name;
+}
+
+tlb_stats_t* add_tlb_level(const char* group, int index, const Json::Value& config, int point) {
+    auto level = new tlb_level_t;
+    level->group = group;
+    level->index = index;
+    level->config = config;
+    level->point = point;
+    report().levels.push_back(level);
+    return &level->stats;
+}
+
+const std::vector<tlb_level_t*>& tlb_levels() {
+    return report().levels;
+}
+
+void print_tlb_group(const char* group, const char* name) {
+    // Allocated on heap as it is fairly large due to padding.
+    std::unique_ptr<tlb_stats_t> sum { new tlb_stats_t() };
+    for (auto level: report().levels) {
+        if (level->group == group && level->point == -1) sum->merge(level->stats);
+    }
+    sum->print(name);
+}
+
+void reset_tlb_levels() {
+    for (auto level: report().levels) level->stats.reset();
+}
+
+// Append data to the statistics file with a single write, so that a snapshot is either entirely in
+// the file or not at all, even if the process is killed while exporting. It is synced to disk
+// before returning.
+static bool append(report_t& report, const std::string& data) {
+    ssize_t written = write(report.fd, data.data(), data.size());
+    bool ok = written == (ssize_t)data.size();
+    if (ok) {
+        report.size += data.size();
+    } else if (written > 0) {
+        // Drop a partially written snapshot, e.g. when the disk is full.
+        if (ftruncate(report.fd, report.size) != 0) ok = false;
+    }
+    return ok && fsync(report.fd) == 0;
+}
+
+void set_stats_file(const std::string& file, const std::string& format) {
+    auto& report = tlbsim::report();
+    report.file = file;
+    report.format = format;
+    report.fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (report.fd == -1 ||
+        (format == "csv" && !append(report, "snapshot,reason,scope,config,hart,counter,value\n"))) {
+        fprintf(stderr, "TLBSim: Cannot open %s\n", file.c_str());
+        exit(1);
+    }
+}
+
+// Export a set of per-hart counters. Harts with all counters being zero are omitted.
+template<typename Counters>
+static Json::Value export_per_hart(Counters counters) {
+    Json::Value total = Json::objectValue;
+    Json::Value harts = Json::objectValue;
+    for (int i = 0; i < MAX_HARTS; i++) {
+        Json::Value hart = counters(i);
+        bool active = false;
+        for (auto& name: hart.getMemberNames()) {
+            total[name] = total.get(name, 0).asUInt64() + hart[name].asUInt64();
+            if (hart[name].asUInt64()) active = true;
+        }
+        if (active) harts[std::to_string(i)] = hart;
+    }
+    Json::Value result;
+    result["total"] = total;
+    result["harts"] = harts;
+    return result;
+}
+
+static Json::Value snapshot(const char* reason) {
+    Json::Value json;
+    json["reason"] = reason;
+    json["instret"] = Json::UInt64(tlbsim_instret);
+    json["minstret"] = Json::UInt64(tlbsim_minstret);
+    json["cputime"] = get_cputime();
+
+    Json::Value tlbs = Json::arrayValue;
+    for (auto level: report().levels) {
+        auto& stats = level->stats;
+        Json::Value tlb = export_per_hart([&](int i) {
+            Json::Value hart;
+            hart["miss"] = Json::UInt64(stats.miss[i]);
+            hart["evict"] = Json::UInt64(stats.evict[i]);
+            hart["flush"] = Json::UInt64(stats.flush[i]);
+            hart["contend"] = Json::UInt64(stats.contend[i]);
+            hart["spin"] = Json::UInt64(stats.spin[i]);
+            hart["race"] = Json::UInt64(stats.race[i]);
+            return hart;
+        });
+        tlb["group"] = level->group;
+        tlb["level"] = level->index;
+        tlb["config"] = level->config;
+        if (level->point != -1) tlb["sweep"] = level->point;
+        tlbs.append(tlb);
+    }
+    json["tlbs"] = tlbs;
+
+    json["faults"] = export_per_hart([](int i) {
+        Json::Value hart;
+        hart["v"] = Json::UInt64(v_fault[i]);
+        hart["u"] = Json::UInt64(u_fault[i]);
+        hart["s"] = Json::UInt64(s_fault[i]);
+        hart["r"] = Json::UInt64(r_fault[i]);
+        hart["w"] = Json::UInt64(w_fault[i]);
+        hart["x"] = Json::UInt64(x_fault[i]);
+        hart["a"] = Json::UInt64(a_fault[i]);
+        hart["d"] = Json::UInt64(d_fault[i]);
+        return hart;
+    });
+
+    json["flushes"] = export_per_hart([](int i) {
+        Json::Value hart;
+        hart["full"] = Json::UInt64(flush_full[i]);
+        hart["gpage"] = Json::UInt64(flush_gpage[i]);
+        hart["asid"] = Json::UInt64(flush_asid[i]);
+        hart["page"] = Json::UInt64(flush_page[i]);
+        return hart;
+    });
+
+    json["walks"] = export_per_hart([](int i) {
+        Json::Value hart;
+        hart["walks"] = Json::UInt64(walks[i]);
+        hart["loads"] = Json::UInt64(walk_loads[i]);
+        hart["saved"] = Json::UInt64(walk_saved[i]);
+        return hart;
+    });
+    return json;
+}
+
+// Flatten the descriptor of a level into a single CSV field, e.g. "assoc=8;size=1024;type=set".
+static std::string describe(const Json::Value& config) {
+    std::string desc;
+    for (auto& name: config.getMemberNames()) {
+        if (!desc.empty()) desc += ';';
+        auto& value = config[name];
+        desc += name + '=' + (value.isString() ? value.asString() : value.toStyledString());
+        // toStyledString terminates the value with a newline
+        if (desc.back() == '\n') desc.pop_back();
+    }
+    // Quotes are escaped by doubling, as the field is quoted.
+    std::string escaped;
+    for (char c: desc) {
+        if (c == '"') escaped += '"';
+        escaped += c;
+    }
+    return escaped;
+}
+
+// One row per counter: snapshot,reason,scope,config,hart,counter,value.
+// Scope is "global", "faults", "flushes", "walks" or the name of a TLB level such as "itlb.0".
+static void write_csv(std::ostream& os, uint64_t index, const Json::Value& json) {
+    std::string prefix = std::to_string(index) + ',' + json["reason"].asString() + ',';
+    for (auto name: {"instret", "minstret", "cputime"}) {
+        os << prefix << "global,,all," << name << ',' << json[name].asString() << '\n';
+    }
+    auto write_per_hart = [&](const std::string& scope, const Json::Value& counters) {
+        auto& total = counters["total"];
+        for (auto& name: total.getMemberNames()) {
+            os << prefix << scope << ",all," << name << ',' << total[name].asUInt64() << '\n';
+        }
+        auto& harts = counters["harts"];
+        for (auto& hart: harts.getMemberNames()) {
+            for (auto& name: harts[hart].getMemberNames()) {
+                os << prefix << scope << ',' << hart << ',' << name << ',' << harts[hart][name].asUInt64() << '\n';
+            }
+        }
+    };
+    for (auto& tlb: json["tlbs"]) {
+        std::string scope = tlb["group"].asString() + '.' + std::to_string(tlb["level"].asInt());
+        if (tlb.isMember("sweep")) scope = "sweep." + std::to_string(tlb["sweep"].asInt()) + '.' + scope;
+        write_per_hart(scope + ",\"" + describe(tlb["config"]) + '"', tlb);
+    }
+    write_per_hart("faults,", json["faults"]);
+    write_per_hart("flushes,", json["flushes"]);
+    write_per_hart("walks,", json["walks"]);
+}
+
+void export_counters(const char* reason) {
+    auto& report = tlbsim::report();
+    if (report.file.empty()) return;
+    auto json = snapshot(reason);
+
+    // Only the new snapshot is written, so exporting takes the same time however many were taken.
+    // It is built in memory first so it can be appended atomically.
+    std::ostringstream os;
+    if (report.format == "csv") {
+        write_csv(os, report.snapshots, json);
+    } else {
+        Json::StreamWriterBuilder builder;
+        builder["indentation"] = "";
+        std::unique_ptr<Json::StreamWriter> writer { builder.newStreamWriter() };
+        writer->write(json, &os);
+        os << '\n';
+    }
+    report.snapshots++;
+    if (!append(report, os.str())) {
+        fprintf(stderr, "TLBSim: Cannot write statistics to %s\n", report.file.c_str());
+    }
+}
+
+}
@@ -0,0 +1,120 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ * Copyright (c) 2019, Gary Guo
+ */
+
+#include <chrono>
+#include <cinttypes>
+
+#include "sampler.h"
+#include "report.h"
+
+namespace tlbsim {
+
+Sampler::Sampler(FILE* file, bool by_instret, uint64_t interval, size_t capacity):
+    by_instret{by_instret}, interval{interval}, next_sample{interval}, file{file} {
+
+    this->capacity = 1;
+    while (this->capacity < capacity) this->capacity <<= 1;
+}
+
+void Sampler::start() {
+    if (!by_instret) names.push_back("accesses");
+    names.push_back("instret");
+    names.push_back("minstret");
+    for (auto level: tlb_levels()) {
+        std::string prefix = level->name() + '.';
+        counters.push_back(&level->stats.miss);
+        names.push_back(prefix + "miss");
+        counters.push_back(&level->stats.evict);
+        names.push_back(prefix + "evict");
+        counters.push_back(&level->stats.flush);
+        names.push_back(prefix + "flush");
+    }
+    std::pair<const sharded_u64_t*, const char*> globals[] = {
+        {&v_fault, "fault.v"}, {&u_fault, "fault.u"}, {&s_fault, "fault.s"}, {&r_fault, "fault.r"},
+        {&w_fault, "fault.w"}, {&x_fault, "fault.x"}, {&a_fault, "fault.a"}, {&d_fault, "fault.d"},
+        {&flush_full, "flush.full"}, {&flush_gpage, "flush.gpage"},
+        {&flush_asid, "flush.asid"}, {&flush_page, "flush.page"},
+        {&walks, "walk.walks"}, {&walk_loads, "walk.loads"}, {&walk_saved, "walk.saved"},
+    };
+    for (auto& global: globals) {
+        counters.push_back(global.first);
+        names.push_back(global.second);
+    }
+    width = names.size();
+
+    slots.reset(new slot_t[capacity]);
+    for (size_t i = 0; i < capacity; i++) slots[i].seq.store(i, std::memory_order_relaxed);
+    data.reset(new uint64_t[capacity * width]);
+
+    for (size_t i = 0; i < width; i++) {
+        fprintf(file, i == 0 ? "%s" : ",%s", names[i].c_str());
+    }
+    fputc('\n', file);
+
+    writer = std::thread([this]() {
+        while (!stopping.load(std::memory_order_acquire)) {
+            drain();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    });
+}
+
+void Sampler::stop() {
+    stopping.store(true, std::memory_order_release);
+    writer.join();
+    drain();
+    fclose(file);
+    uint64_t dropped = this->dropped.load(std::memory_order_relaxed);
+    if (dropped) {
+        fprintf(stderr, "TLBSim: %" PRIu64 " samples dropped as the writer falls behind\n", dropped);
+    }
+}
+
+void Sampler::sample(uint64_t now) {
+    // Claim a slot. This is the enqueue operation of a bounded multi-producer queue.
+    uint64_t pos = head.load(std::memory_order_relaxed);
+    slot_t* slot;
+    while (true) {
+        slot = &slots[pos & (capacity - 1)];
+        uint64_t seq = slot->seq.load(std::memory_order_acquire);
+        int64_t diff = (int64_t)(seq - pos);
+        if (diff == 0) {
+            if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            // The writer has not yet consumed the slot from the last round.
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            pos = head.load(std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t* row = &data[(pos & (capacity - 1)) * width];
+    if (!by_instret) *row++ = now;
+    *row++ = __atomic_load_n(&tlbsim_instret, __ATOMIC_RELAXED);
+    *row++ = __atomic_load_n(&tlbsim_minstret, __ATOMIC_RELAXED);
+    for (auto counter: counters) *row++ = **counter;
+    slot->seq.store(pos + 1, std::memory_order_release);
+}
+
+void Sampler::drain() {
+    uint64_t pos = tail.load(std::memory_order_relaxed);
+    while (true) {
+        auto& slot = slots[pos & (capacity - 1)];
+        if (slot.seq.load(std::memory_order_acquire) != pos + 1) break;
+        uint64_t* row = &data[(pos & (capacity - 1)) * width];
+        for (size_t i = 0; i < width; i++) {
+            fprintf(file, i == 0 ? "%" PRIu64 : ",%" PRIu64, row[i]);
+        }
+        fputc('\n', file);
+        // Hand the slot back to producers for the next round.
+        slot.seq.store(pos + capacity, std::memory_order_release);
+        pos++;
+    }
+    tail.store(pos, std::memory_order_relaxed);
+    fflush(file);
+}
+
+}
@@ -9,6 +9,12 @@
 #include "tlb.h"
 #include "config.h"
 #include "stats.h"
+#include "report.h"
+#include "sampler.h"
+#include "offline.h"
+#include "mrc.h"
+#include "walk_cache.h"
+#include "lookup.h"
 
 using namespace tlbsim;
 
@@ -19,13 +25,17 @@ __attribute__((visibility("default")))
 bool tlbsim_need_minstret = true;
 
 static void print_counters() {
+    fprintf(stderr, "Lookup kernel: %s\n", lookup_kernel_name);
     print_instrets();
-    itlb_stats.print("I-TLB");
-    dtlb_stats.print("D-TLB");
-    ctlb_stats.print("C-TLB");
-    stlb_stats.print("S-TLB");
+    print_tlb_group("itlb", "I-TLB");
+    print_tlb_group("dtlb", "D-TLB");
+    print_tlb_group("ctlb", "C-TLB");
+    print_tlb_group("stlb", "S-TLB");
+    print_tlb_group("pwc", "PWC");
+    print_mrc_curves();
     print_faults();
     print_flushes();
+    print_walks();
 
     fprintf(stderr, "User Time: %lg\n", get_cputime());
 }
@@ -33,26 +43,32 @@ static void print_counters() {
 static void reset_counters() {
     tlbsim_instret = 0;
     tlbsim_minstret = 0;
-    itlb_stats.reset();
-    dtlb_stats.reset();
-    ctlb_stats.reset();
-    stlb_stats.reset();
+    reset_tlb_levels();
+    reset_mrc_curves();
+    if (config_sampler) config_sampler->reset();
 }
 
 __attribute__((visibility("default")))
 void tlbsim_reset_counters(bool print) {
     if (print) print_counters();
+    export_counters("reset");
     reset_counters();
 }
 
 /* Display counters at exit */
 __attribute__((destructor))
 static void print_counters_at_exit(void) {
+    if (config_sampler) config_sampler->stop();
+    stop_access_loggers();
     print_counters();
+    export_counters("exit");
 }
 
 __attribute__((visibility("default")))
 tlbsim_resp_t tlbsim_access(tlbsim_req_t* req) {
+    current_hart = req->hartid;
+    if (config_sampler) config_sampler->tick();
+
     // Choose the TLB
     auto& tlb = (req->ifetch ? config_itlbs : config_dtlbs)[req->hartid];
 
@@ -67,16 +83,64 @@ tlbsim_resp_t tlbsim_access(tlbsim_req_t* req) {
     tlb_entry_t search;
     search.vpn = req->vpn;
     search.asid = req->asid;
+    search.granularity = 0;
     tlbsim_resp_t resp;
     resp.perm = tlb->access(search, *req) == 0;
     resp.ppn = search.ppn;
     resp.pte = search.pte;
-    resp.granularity = 0;
+    resp.granularity = search.granularity;
+    flush_l0(req->hartid);
     return resp;
 }
 
+// Access requests of the same hart and the same TLB as a batch.
+static void access_batch(tlbsim_req_t* reqs, tlbsim_resp_t* resps, size_t count) {
+    int hartid = reqs[0].hartid;
+    current_hart = hartid;
+    auto& tlb = (reqs[0].ifetch ? config_itlbs : config_dtlbs)[hartid];
+    if (!tlb) {
+        setup_private_tlb(hartid);
+    }
+
+    tlb_entry_t searches[MAX_BATCH];
+    int perms[MAX_BATCH];
+    for (size_t i = 0; i < count; i++) {
+        auto& req = reqs[i];
+        if (config_sampler) config_sampler->tick();
+        if (req.asid == 0) req.asid = hartid;
+        searches[i].vpn = req.vpn;
+        searches[i].asid = req.asid;
+        searches[i].granularity = 0;
+    }
+    tlb->access_batch(searches, reqs, perms, count);
+    for (size_t i = 0; i < count; i++) {
+        resps[i].perm = perms[i] == 0;
+        resps[i].ppn = searches[i].ppn;
+        resps[i].pte = searches[i].pte;
+        resps[i].granularity = searches[i].granularity;
+    }
+    flush_l0(hartid);
+}
+
+__attribute__((visibility("default")))
+void tlbsim_access_batch(tlbsim_req_t* reqs, tlbsim_resp_t* resps, size_t count) {
+    // Split the requests into runs of the same hart and the same TLB, so they are accessed in
+    // order.
+    for (size_t start = 0, end; start < count; start = end) {
+        for (
+            end = start + 1;
+            end < count && end - start < MAX_BATCH &&
+                reqs[end].hartid == reqs[start].hartid && reqs[end].ifetch == reqs[start].ifetch;
+            end++
+        );
+        access_batch(reqs + start, resps + start, end - start);
+    }
+}
+
 __attribute__((visibility("default")))
 void tlbsim_flush(int hartid, int asid, uint64_t vpn) {
+    current_hart = hartid;
+
     // First increment the statistics
     if (vpn == 0) {
         if (asid == -1) ++flush_full;
@@ -99,6 +163,8 @@ void tlbsim_flush(int hartid, int asid, uint64_t vpn) {
 
     config_itlbs[hartid]->flush_local(asid_new, vpn);
     config_dtlbs[hartid]->flush(asid_new, vpn);
+    if (config_pwcs[hartid]) config_pwcs[hartid]->flush(asid_new, vpn);
+    flush_l0(hartid);
 }
 
 
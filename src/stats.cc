@@ -16,34 +16,54 @@ uint64_t tlbsim_minstret;
 
 namespace tlbsim {
 
-atomic_u64_t v_fault;
-atomic_u64_t u_fault;
-atomic_u64_t s_fault;
-atomic_u64_t r_fault;
-atomic_u64_t w_fault;
-atomic_u64_t x_fault;
-atomic_u64_t a_fault;
-atomic_u64_t d_fault;
-
-atomic_u64_t flush_full;
-atomic_u64_t flush_gpage;
-atomic_u64_t flush_asid;
-atomic_u64_t flush_page;
-
-tlb_stats_t itlb_stats;
-tlb_stats_t dtlb_stats;
-tlb_stats_t ctlb_stats;
-tlb_stats_t stlb_stats;
+thread_local int current_hart __attribute__((tls_model("initial-exec")));
+
+sharded_u64_t v_fault;
+sharded_u64_t u_fault;
+sharded_u64_t s_fault;
+sharded_u64_t r_fault;
+sharded_u64_t w_fault;
+sharded_u64_t x_fault;
+sharded_u64_t a_fault;
+sharded_u64_t d_fault;
+
+sharded_u64_t flush_full;
+sharded_u64_t flush_gpage;
+sharded_u64_t flush_asid;
+sharded_u64_t flush_page;
+
+sharded_u64_t walks;
+sharded_u64_t walk_loads;
+sharded_u64_t walk_saved;
 
 void print_instrets() {
     fprintf(stderr, "Total instructions : %ld\n", tlbsim_instret);
     fprintf(stderr, "Memory Instructions: %ld\n", tlbsim_minstret);
 }
 
+// Print per-hart breakdown of a value, if more than one hart has a non-zero value.
+template<typename Value>
+static void print_per_hart(Value value) {
+    int active = 0;
+    for (int i = 0; i < MAX_HARTS; i++) {
+        if (value(i)) active++;
+    }
+    if (active <= 1) return;
+    for (int i = 0; i < MAX_HARTS; i++) {
+        uint64_t count = value(i);
+        if (count) fprintf(stderr, "  Hart %-2d: %ld\n", i, count);
+    }
+}
+
 void print_faults() {
-    uint64_t pagefaults = *v_fault + *u_fault + *s_fault + *r_fault + *w_fault + *x_fault;
-    if (!config_update_pte)
-        pagefaults += *a_fault + *d_fault;
+    auto pagefaults_of = [](int i) {
+        uint64_t pagefaults = v_fault[i] + u_fault[i] + s_fault[i] + r_fault[i] + w_fault[i] + x_fault[i];
+        if (!config_update_pte)
+            pagefaults += a_fault[i] + d_fault[i];
+        return pagefaults;
+    };
+    uint64_t pagefaults = 0;
+    for (int i = 0; i < MAX_HARTS; i++) pagefaults += pagefaults_of(i);
     fprintf(stderr, "Pagefaults:\n");
     fprintf(stderr, "  Total: %ld\n", pagefaults);
     fprintf(stderr, "  V    : %ld\n", *v_fault);
@@ -54,6 +74,7 @@ void print_faults() {
     fprintf(stderr, "  X    : %ld\n", *x_fault);
     fprintf(stderr, "  A    : %ld\n", *a_fault);
     fprintf(stderr, "  D    : %ld\n", *d_fault);
+    print_per_hart(pagefaults_of);
 }
 
 void print_flushes() {
@@ -63,6 +84,17 @@ void print_flushes() {
     fprintf(stderr, "  with      addr: %ld\n", *flush_gpage);
     fprintf(stderr, "  with asid     : %ld\n", *flush_asid);
     fprintf(stderr, "  with asid/addr: %ld\n", *flush_page);
+    print_per_hart([](int i) {
+        return flush_full[i] + flush_gpage[i] + flush_asid[i] + flush_page[i];
+    });
+}
+
+void print_walks() {
+    fprintf(stderr, "Page walks:\n");
+    fprintf(stderr, "  Total      : %ld\n", *walks);
+    fprintf(stderr, "  PTE loads  : %ld\n", *walk_loads);
+    fprintf(stderr, "  Loads saved: %ld\n", *walk_saved);
+    print_per_hart([](int i) { return walks[i]; });
 }
 
 void tlb_stats_t::print(const char* name) {
@@ -70,6 +102,22 @@ void tlb_stats_t::print(const char* name) {
     fprintf(stderr, "  Miss    : %ld\n", *this->miss);
     fprintf(stderr, "  Eviction: %ld\n", *this->evict);
     fprintf(stderr, "  Flush   : %ld\n", *this->flush);
+    fprintf(stderr, "  Contend : %ld\n", *this->contend);
+    fprintf(stderr, "  Spin    : %ld\n", *this->spin);
+    fprintf(stderr, "  Race    : %ld\n", *this->race);
+
+    int active = 0;
+    for (int i = 0; i < MAX_HARTS; i++) {
+        if (this->miss[i] || this->evict[i] || this->flush[i]) active++;
+    }
+    if (active <= 1) return;
+    for (int i = 0; i < MAX_HARTS; i++) {
+        if (!(this->miss[i] || this->evict[i] || this->flush[i])) continue;
+        fprintf(
+            stderr, "  Hart %-3d: miss %ld, eviction %ld, flush %ld\n",
+            i, this->miss[i], this->evict[i], this->flush[i]
+        );
+    }
 }
 
 }
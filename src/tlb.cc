@@ -3,6 +3,10 @@
  * Copyright (c) 2019, Gary Guo
  */
 
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
 #include "tlb.h"
 #include "stats.h"
 #include "config.h"
@@ -10,23 +14,101 @@
 namespace tlbsim {
 
 int TLB::access(tlb_entry_t &search, const tlbsim_req_t& req) {
-    int perm;
-    if (find_and_lock(search)) {
-        perm = pte_permission_check(search.pte, req);
-        if (perm <= 0 || !config_update_pte) goto unlock;
+    return access_impl(this, search, req);
+}
+
+// Serialises additions of children of all levels, as harts are set up concurrently.
+static Spinlock children_lock;
+
+void TLB::add_child(TLB* child) {
+    children_lock.lock();
+    int count = num_children.load(std::memory_order_relaxed);
+    if (count == MAX_CHILDREN) {
+        fprintf(stderr, "TLBSim: Too many levels above a TLB\n");
+        abort();
     }
+    children[count] = child;
+    num_children.store(count + 1, std::memory_order_release);
+    children_lock.unlock();
+}
 
-    ++stats->miss;
+void TLB::evict(const tlb_entry_t& entry, bool spill) {
+    if (inclusion == inclusion_t::INCLUSIVE) {
+        if (hartid != -1) {
+            // The L0 TLB may hold any page of a superpage, so it is flushed entirely.
+            invalidate_l0(hartid, entry.granularity ? 0 : entry.vpn, 3);
+        }
+        int count = num_children.load(std::memory_order_acquire);
+        for (int i = 0; i < count; i++) children[i]->back_invalidate(entry);
+    }
+    if (spill && parent->inclusion == inclusion_t::EXCLUSIVE) parent->insert(entry);
+}
 
-    perm = parent->access(search, req);
-    if (!config_cache_inv && perm != 0) goto unlock;
+void TLB::back_invalidate(const tlb_entry_t& entry) {
+    int count = num_children.load(std::memory_order_acquire);
+    for (int i = 0; i < count; i++) children[i]->back_invalidate(entry);
+}
 
-    insert_and_unlock(search);
-    return perm;
+// L0 invalidations queued for a hart. Each page is only queued once.
+struct alignas(CACHE_LINE_SIZE) l0_queue_t {
+    Spinlock lock;
+    // Types of L0 TLBs to invalidate, 0 if nothing is queued. It can be checked without the lock.
+    std::atomic<int> type {0};
+    // Whether all pages are invalidated, in which case vpns are not used.
+    bool all;
+    int count;
+    uint64_t vpns[MAX_L0_INVALIDATIONS];
+};
 
-unlock:
-    unlock(search);
-    return perm;
+static l0_queue_t l0_queues[MAX_HARTS];
+
+void invalidate_l0(int hartid, uint64_t vpn, int type) {
+    auto& queue = l0_queues[hartid];
+    queue.lock.lock();
+    queue.type.store(queue.type.load(std::memory_order_relaxed) | type, std::memory_order_relaxed);
+    if (!queue.all) {
+        bool queued = false;
+        for (int i = 0; i < queue.count; i++) {
+            if (queue.vpns[i] == vpn) {
+                queued = true;
+                break;
+            }
+        }
+        if (!queued) {
+            if (vpn == 0 || queue.count == MAX_L0_INVALIDATIONS) {
+                queue.all = true;
+            } else {
+                queue.vpns[queue.count++] = vpn;
+            }
+        }
+    }
+    queue.lock.unlock();
+}
+
+void flush_l0(int hartid) {
+    auto& queue = l0_queues[hartid];
+    if (!queue.type.load(std::memory_order_relaxed)) return;
+
+    uint64_t vpns[MAX_L0_INVALIDATIONS];
+    queue.lock.lock();
+    int type = queue.type.load(std::memory_order_relaxed);
+    bool all = queue.all;
+    int count = queue.count;
+    std::copy(queue.vpns, queue.vpns + count, vpns);
+    queue.type.store(0, std::memory_order_relaxed);
+    queue.all = false;
+    queue.count = 0;
+    queue.lock.unlock();
+
+    if (all) {
+        tlbsim_client.invalidate_l0(&tlbsim_client, hartid, 0, type);
+    } else if (tlbsim_client.invalidate_l0_batch) {
+        tlbsim_client.invalidate_l0_batch(&tlbsim_client, hartid, vpns, count, type);
+    } else {
+        for (int i = 0; i < count; i++) {
+            tlbsim_client.invalidate_l0(&tlbsim_client, hartid, vpns[i], type);
+        }
+    }
 }
 
 }
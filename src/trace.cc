@@ -0,0 +1,291 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ * Copyright (c) 2019, Gary Guo
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "codec.h"
+
+namespace tlbsim {
+
+// Bits of the first varint of a record
+enum {
+    RECORD_FLUSH = 1 << 0,
+    RECORD_IFETCH = 1 << 1,
+    RECORD_WRITE = 1 << 2,
+    RECORD_SUPERVISOR = 1 << 3,
+    RECORD_SUM = 1 << 4,
+    RECORD_MXR = 1 << 5,
+    // SATP differs from the last access of the hart
+    RECORD_SATP = 1 << 6,
+    // ASID differs from the last access of the hart
+    RECORD_ASID = 1 << 7,
+    RECORD_GRANULARITY_SHIFT = 8,
+    // ASID of the entry is the requested ASID with the global bit set
+    RECORD_GLOBAL = 1 << 10,
+    // ASID of the entry is unrelated to the requested ASID, and is stored explicitly
+    RECORD_ENTRY_ASID = 1 << 11,
+    // VPN of the entry differs from the requested VPN, and is stored explicitly
+    RECORD_ENTRY_VPN = 1 << 12,
+    RECORD_HART_SHIFT = 13,
+};
+
+static inline uint64_t zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static inline void put_varint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(value | 0x80);
+        value >>= 7;
+    }
+    out.push_back(value);
+}
+
+static inline bool get_varint(const uint8_t*& ptr, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (ptr == end) return false;
+        uint8_t byte = *ptr++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+TraceEncoder::TraceEncoder(bool compress): compress{compress} {
+    block.reserve(BLOCK_SIZE + 64);
+    header.count = 0;
+}
+
+void TraceEncoder::encode(const packet_t& packet, uint64_t instret) {
+    if (header.count == 0) {
+        header.instret = instret;
+        memset(harts, 0, sizeof(harts));
+    }
+    header.count++;
+
+    if (packet.tag == packet_t::FLUSH) {
+        put_varint(block, RECORD_FLUSH);
+        put_varint(block, zigzag((int32_t)packet.flush.asid));
+        put_varint(block, packet.flush.vpn);
+        return;
+    }
+
+    auto& req = packet.access.req;
+    auto& search = packet.access.search;
+    auto& hart = harts[req.hartid];
+    uint64_t bits =
+        (req.ifetch ? RECORD_IFETCH : 0) |
+        (req.write ? RECORD_WRITE : 0) |
+        (req.supervisor ? RECORD_SUPERVISOR : 0) |
+        (req.sum ? RECORD_SUM : 0) |
+        (req.mxr ? RECORD_MXR : 0) |
+        (req.satp != hart.satp ? RECORD_SATP : 0) |
+        (req.asid != hart.asid ? RECORD_ASID : 0) |
+        (search.vpn != req.vpn ? RECORD_ENTRY_VPN : 0) |
+        (uint64_t)(search.granularity & 3) << RECORD_GRANULARITY_SHIFT |
+        (uint64_t)req.hartid << RECORD_HART_SHIFT;
+    if ((int32_t)search.asid == (int32_t)req.asid) {
+        // Nothing to store
+    } else if ((int32_t)search.asid == (int32_t)(req.asid | 0x80000000)) {
+        bits |= RECORD_GLOBAL;
+    } else {
+        bits |= RECORD_ENTRY_ASID;
+    }
+
+    put_varint(block, bits);
+    if (bits & RECORD_SATP) put_varint(block, req.satp);
+    if (bits & RECORD_ASID) put_varint(block, req.asid);
+    put_varint(block, zigzag(req.vpn - hart.vpn));
+    if (bits & RECORD_ENTRY_ASID) put_varint(block, zigzag((int32_t)search.asid));
+    if (bits & RECORD_ENTRY_VPN) put_varint(block, search.vpn);
+    // Pages close in virtual memory tend to be close in physical memory as well.
+    put_varint(block, zigzag(search.ppn - (hart.ppn + (req.vpn - hart.vpn))));
+    // For leaf PTEs, this leaves only the flags.
+    put_varint(block, search.pte ^ (search.ppn << 10));
+
+    hart.satp = req.satp;
+    hart.asid = req.asid;
+    hart.vpn = req.vpn;
+    hart.ppn = search.ppn;
+}
+
+void TraceEncoder::flush(std::ostream& os) {
+    if (header.count == 0) return;
+    header.raw_size = block.size();
+    header.size = block.size();
+    header.flags = 0;
+    const uint8_t* payload = block.data();
+    if (compress) {
+        compressed.resize(lz_bound(block.size()));
+        size_t size = lz_compress(block.data(), block.size(), compressed.data());
+        // Incompressible blocks are stored as is.
+        if (size < block.size()) {
+            header.size = size;
+            header.flags |= block_header_t::COMPRESSED;
+            payload = compressed.data();
+        }
+    }
+    os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    os.write(reinterpret_cast<const char*>(payload), header.size);
+    block.clear();
+    header.count = 0;
+}
+
+bool TraceDecoder::load(const block_header_t& header, const uint8_t* payload) {
+    if (header.flags & block_header_t::COMPRESSED) {
+        buffer.resize(header.raw_size);
+        if (!lz_decompress(payload, header.size, buffer.data(), header.raw_size)) return false;
+        payload = buffer.data();
+    } else if (header.size != header.raw_size) {
+        return false;
+    }
+    ptr = payload;
+    end = payload + header.raw_size;
+    count = header.count;
+    memset(harts, 0, sizeof(harts));
+    return true;
+}
+
+bool TraceDecoder::next(packet_t& packet) {
+    if (count == 0) return false;
+    count--;
+
+    // Clear the padding, so decoded packets are deterministic.
+    memset(&packet, 0, sizeof(packet));
+    uint64_t bits;
+    if (!get_varint(ptr, end, bits)) goto malformed;
+
+    if (bits & RECORD_FLUSH) {
+        uint64_t asid, vpn;
+        if (!get_varint(ptr, end, asid) || !get_varint(ptr, end, vpn)) goto malformed;
+        packet.tag = packet_t::FLUSH;
+        packet.flush.asid = (int32_t)unzigzag(asid);
+        packet.flush.vpn = vpn;
+        return true;
+    }
+
+    {
+        uint64_t hartid = bits >> RECORD_HART_SHIFT;
+        if (hartid >= MAX_HARTS) goto malformed;
+        auto& hart = harts[hartid];
+        auto& req = packet.access.req;
+        auto& search = packet.access.search;
+        packet.tag = packet_t::ACCESS;
+        req.hartid = hartid;
+        req.ifetch = !!(bits & RECORD_IFETCH);
+        req.write = !!(bits & RECORD_WRITE);
+        req.supervisor = !!(bits & RECORD_SUPERVISOR);
+        req.sum = !!(bits & RECORD_SUM);
+        req.mxr = !!(bits & RECORD_MXR);
+        search.granularity = (bits >> RECORD_GRANULARITY_SHIFT) & 3;
+
+        uint64_t value;
+        req.satp = hart.satp;
+        if (bits & RECORD_SATP) {
+            if (!get_varint(ptr, end, req.satp)) goto malformed;
+        }
+        req.asid = hart.asid;
+        if (bits & RECORD_ASID) {
+            if (!get_varint(ptr, end, value)) goto malformed;
+            req.asid = value;
+        }
+        if (!get_varint(ptr, end, value)) goto malformed;
+        req.vpn = hart.vpn + unzigzag(value);
+
+        search.asid = req.asid;
+        if (bits & RECORD_GLOBAL) search.asid.global(true);
+        if (bits & RECORD_ENTRY_ASID) {
+            if (!get_varint(ptr, end, value)) goto malformed;
+            search.asid = (int32_t)unzigzag(value);
+        }
+        search.vpn = req.vpn;
+        if (bits & RECORD_ENTRY_VPN) {
+            if (!get_varint(ptr, end, search.vpn)) goto malformed;
+        }
+        if (!get_varint(ptr, end, value)) goto malformed;
+        search.ppn = hart.ppn + (req.vpn - hart.vpn) + unzigzag(value);
+        if (!get_varint(ptr, end, value)) goto malformed;
+        search.pte = value ^ (search.ppn << 10);
+
+        hart.satp = req.satp;
+        hart.asid = req.asid;
+        hart.vpn = req.vpn;
+        hart.ppn = search.ppn;
+        return true;
+    }
+
+malformed:
+    fprintf(stderr, "TLBSim: Malformed trace\n");
+    exit(1);
+}
+
+// Size of reads when the input is streamed.
+static constexpr size_t STREAM_CHUNK = 1 << 20;
+
+TraceInput::TraceInput(const char* path) {
+    if (strcmp(path, "-") == 0) {
+        stream = stdin;
+        return;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "TLBSim: File %s does not exist\n", path);
+        exit(1);
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr != MAP_FAILED) {
+            // Traces are read once from start to end, so read ahead aggressively and drop pages
+            // behind.
+            madvise(ptr, st.st_size, MADV_SEQUENTIAL);
+            madvise(ptr, st.st_size, MADV_WILLNEED);
+            map = static_cast<const uint8_t*>(ptr);
+            size = st.st_size;
+            close(fd);
+            return;
+        }
+    }
+    stream = fdopen(fd, "rb");
+}
+
+TraceInput::~TraceInput() {
+    if (map) munmap(const_cast<uint8_t*>(map), size);
+    if (stream && stream != stdin) fclose(stream);
+}
+
+bool TraceInput::fill(size_t count) {
+    if (size - pos >= count) return true;
+
+    // Move the remaining bytes to the front, and read in at least a chunk.
+    size_t left = size - pos;
+    memmove(buffer.data(), buffer.data() + pos, left);
+    pos = 0;
+    size = left;
+    size_t capacity = count > STREAM_CHUNK ? count : STREAM_CHUNK;
+    if (buffer.size() < capacity) buffer.resize(capacity);
+    while (size < count) {
+        size_t read = fread(buffer.data() + size, 1, buffer.size() - size, stream);
+        if (read == 0) return false;
+        size += read;
+    }
+    return true;
+}
+
+}
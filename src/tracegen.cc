@@ -0,0 +1,303 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ * Copyright (c) 2019, Gary Guo
+ *
+ * Generator of synthetic traces, which can be replayed like recorded ones. The workload is
+ * described by a json file; see README.md for the options.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <json/json.h>
+
+#include "config.h"
+#include "pgtable.h"
+#include "trace.h"
+
+using namespace tlbsim;
+
+// User streams are laid out upwards from USER_VPN, and global streams downwards from the top of
+// the address space. Streams are aligned to 2M pages.
+static constexpr uint64_t USER_VPN = 0x10000;
+static constexpr uint64_t TOP_VPN = 1ULL << 52;
+static constexpr uint64_t STREAM_ALIGN = 512;
+
+struct stream_t {
+    enum {
+        SCAN,
+        UNIFORM,
+        ZIPF,
+        CHASE,
+    } pattern;
+    uint64_t base;
+    uint64_t pages;
+    uint64_t stride;
+    double weight;
+    double write;
+    bool ifetch;
+    bool global;
+    // Cumulative probabilities of ranks, for ZIPF.
+    std::vector<double> cdf;
+    // For ZIPF, page of each rank, so popular pages are scattered. For CHASE, the next page of each
+    // page, which forms a single cycle.
+    std::vector<uint32_t> order;
+};
+
+struct hart_t {
+    // Position of the hart in each stream.
+    std::vector<uint64_t> cursors;
+    // Index of the current address space of the hart.
+    int space = 0;
+    uint64_t accesses = 0;
+};
+
+static Json::Value read_json(const char *path) {
+    Json::Value json;
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "TLBSim: File " << path << " does not exist\n";
+        exit(1);
+    }
+    try {
+        file >> json;
+    } catch (std::exception&) {
+        std::cerr << "TLBSim: Error parsing " << path << " as json\n";
+        exit(1);
+    }
+    return json;
+}
+
+static void setup_stream(stream_t& stream, const Json::Value& spec, std::mt19937_64& rng) {
+    auto pattern = spec.get("pattern", "uniform").asString();
+    stream.pages = spec.get("pages", 4096).asUInt64();
+    stream.stride = spec.get("stride", 1).asUInt64();
+    stream.weight = spec.get("weight", 1).asDouble();
+    stream.write = spec.get("write", 0).asDouble();
+    stream.ifetch = spec.get("ifetch", false).asBool();
+    stream.global = spec.get("global", false).asBool();
+    if (stream.pages == 0 || stream.pages > UINT32_MAX || stream.weight < 0) {
+        fprintf(stderr, "TLBSim: Invalid stream\n");
+        exit(1);
+    }
+
+    if (pattern == "scan") {
+        stream.pattern = stream_t::SCAN;
+    } else if (pattern == "uniform") {
+        stream.pattern = stream_t::UNIFORM;
+    } else if (pattern == "zipf") {
+        stream.pattern = stream_t::ZIPF;
+        double alpha = spec.get("alpha", 0.99).asDouble();
+        stream.cdf.resize(stream.pages);
+        double sum = 0;
+        for (uint64_t i = 0; i < stream.pages; i++) {
+            sum += 1 / pow(i + 1, alpha);
+            stream.cdf[i] = sum;
+        }
+        for (auto& value: stream.cdf) value /= sum;
+        stream.order.resize(stream.pages);
+        for (uint64_t i = 0; i < stream.pages; i++) stream.order[i] = i;
+        std::shuffle(stream.order.begin(), stream.order.end(), rng);
+    } else if (pattern == "chase") {
+        stream.pattern = stream_t::CHASE;
+        // Sattolo's algorithm, which gives a permutation of a single cycle.
+        stream.order.resize(stream.pages);
+        for (uint64_t i = 0; i < stream.pages; i++) stream.order[i] = i;
+        for (uint64_t i = stream.pages - 1; i > 0; i--) {
+            std::swap(stream.order[i], stream.order[rng() % i]);
+        }
+    } else {
+        fprintf(stderr, "TLBSim: %s is not an accepted access pattern\n", pattern.c_str());
+        exit(1);
+    }
+}
+
+// Offset of the next page a hart accesses in a stream.
+static uint64_t next_page(stream_t& stream, uint64_t& cursor, std::mt19937_64& rng) {
+    switch (stream.pattern) {
+        case stream_t::SCAN:
+            return cursor++ * stream.stride % stream.pages;
+        case stream_t::UNIFORM:
+            return rng() % stream.pages;
+        case stream_t::ZIPF: {
+            double value = std::uniform_real_distribution<double>()(rng);
+            auto rank = std::lower_bound(stream.cdf.begin(), stream.cdf.end(), value) - stream.cdf.begin();
+            return stream.order[std::min<uint64_t>(rank, stream.pages - 1)];
+        }
+        case stream_t::CHASE:
+            return cursor = stream.order[cursor];
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <spec.json> <output>\n", argv[0]);
+        return 1;
+    }
+    Json::Value spec = read_json(argv[1]);
+    std::string spec_text = Json::writeString(Json::StreamWriterBuilder(), spec);
+
+    int harts = spec.get("harts", 1).asInt();
+    uint64_t accesses = spec.get("accesses", 1000000).asUInt64();
+    std::mt19937_64 rng(spec.get("seed", 1).asUInt64());
+    bool sv48 = spec.get("sv48", false).asBool();
+    bool compress = spec.get("compress", true).asBool();
+    int spaces = spec.get("asids", 1).asInt();
+    uint64_t switch_interval = spec.get("switch_interval", 0).asUInt64();
+    auto switch_flush = spec.get("switch_flush", "none").asString();
+    uint64_t flush_interval = spec.get("flush_interval", 0).asUInt64();
+    uint64_t instret_per_access = spec.get("instret_per_access", 4).asUInt64();
+    if (harts <= 0 || harts > MAX_HARTS || spaces <= 0 || (harts * spaces) >= 0xffff) {
+        fprintf(stderr, "TLBSim: Invalid number of harts or ASIDs\n");
+        return 1;
+    }
+    if (switch_flush != "none" && switch_flush != "asid" && switch_flush != "full") {
+        fprintf(stderr, "TLBSim: %s is not an accepted context switch flush\n", switch_flush.c_str());
+        return 1;
+    }
+
+    auto& stream_specs = spec["streams"];
+    if (!stream_specs.isArray() || stream_specs.empty()) {
+        fprintf(stderr, "TLBSim: At least one stream is needed\n");
+        return 1;
+    }
+    std::vector<stream_t> streams(stream_specs.size());
+    std::vector<double> weights;
+    uint64_t user_vpn = USER_VPN;
+    uint64_t global_vpn = TOP_VPN;
+    for (Json::ArrayIndex i = 0; i < stream_specs.size(); i++) {
+        auto& stream = streams[i];
+        setup_stream(stream, stream_specs[i], rng);
+        uint64_t size = (stream.pages + STREAM_ALIGN - 1) / STREAM_ALIGN * STREAM_ALIGN;
+        if (stream.global) {
+            global_vpn -= size;
+            stream.base = global_vpn;
+        } else {
+            stream.base = user_vpn;
+            user_vpn += size;
+        }
+        weights.push_back(stream.weight);
+    }
+    // Both halves of the address space must be within the canonical range.
+    uint64_t half = 1ULL << ((sv48 ? 4 : 3) * 9 - 1);
+    if (user_vpn > half || TOP_VPN - global_vpn > half) {
+        fprintf(stderr, "TLBSim: Streams do not fit in the address space\n");
+        return 1;
+    }
+    std::discrete_distribution<int> pick_stream(weights.begin(), weights.end());
+
+    std::vector<hart_t> states(harts);
+    for (int i = 0; i < harts; i++) {
+        auto& state = states[i];
+        // Harts start at different places of each stream.
+        for (auto& stream: streams) {
+            state.cursors.push_back(stream.pages * i / harts);
+        }
+    }
+
+    std::ofstream file;
+    bool to_stdout = strcmp(argv[2], "-") == 0;
+    if (!to_stdout) {
+        file.open(argv[2], std::ios::binary);
+        if (!file) {
+            fprintf(stderr, "TLBSim: Cannot open %s\n", argv[2]);
+            return 1;
+        }
+    }
+    std::ostream& os = to_stdout ? std::cout : file;
+
+    trace_header_t header;
+    memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    header.version = 2;
+    header.endian = TRACE_ENDIAN;
+    header.harts = harts;
+    header.flags = 0;
+    header.config_size = spec_text.size();
+    os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    os.write(spec_text.data(), spec_text.size());
+
+    TraceEncoder encoder(compress);
+    uint64_t instret = 0;
+    uint64_t flushes = 0;
+    auto emit = [&](const packet_t& packet) {
+        encoder.encode(packet, instret);
+        if (encoder.full()) encoder.flush(os);
+    };
+    auto emit_flush = [&](asid_t asid, uint64_t vpn) {
+        packet_t packet;
+        memset(&packet, 0, sizeof(packet));
+        packet.tag = packet_t::FLUSH;
+        packet.flush.asid = asid;
+        packet.flush.vpn = vpn;
+        emit(packet);
+        flushes++;
+    };
+
+    for (uint64_t n = 0; n < accesses * harts; n++) {
+        int hartid = rng() % harts;
+        auto& state = states[hartid];
+        // Address spaces are private to harts.
+        int asid = hartid * spaces + state.space + 1;
+
+        if (switch_interval && state.accesses && state.accesses % switch_interval == 0) {
+            state.space = rng() % spaces;
+            asid = hartid * spaces + state.space + 1;
+            if (switch_flush == "asid") {
+                emit_flush(asid, 0);
+            } else if (switch_flush == "full") {
+                asid_t all = 0;
+                all.global(true);
+                emit_flush(all, 0);
+            }
+        }
+        if (flush_interval && state.accesses && state.accesses % flush_interval == 0) {
+            // Unmap a random user page of the current address space.
+            auto& stream = streams[rng() % streams.size()];
+            if (!stream.global) emit_flush(asid, stream.base + rng() % stream.pages);
+        }
+        state.accesses++;
+
+        int index = pick_stream(rng);
+        auto& stream = streams[index];
+        uint64_t vpn = stream.base + next_page(stream, state.cursors[index], rng);
+
+        packet_t packet;
+        memset(&packet, 0, sizeof(packet));
+        packet.tag = packet_t::ACCESS;
+        auto& req = packet.access.req;
+        auto& search = packet.access.search;
+        req.asid = asid;
+        req.hartid = hartid;
+        req.satp = (sv48 ? SATP_MODE_SV48 : SATP_MODE_SV39) | (uint64_t)asid << 44 | (0x1000 + asid);
+        req.vpn = vpn;
+        req.ifetch = stream.ifetch;
+        req.write = !stream.ifetch && std::uniform_real_distribution<double>()(rng) < stream.write;
+        req.supervisor = stream.global;
+
+        search.vpn = vpn;
+        search.asid = asid;
+        search.asid.global(stream.global);
+        // Each address space maps its pages contiguously, and global pages are shared.
+        search.ppn = stream.global ? 0x80000 + (vpn & 0xffffff) : ((uint64_t)asid << 28) + vpn;
+        search.pte = search.ppn << 10 | PTE_V | PTE_R | PTE_W | PTE_X | PTE_A | PTE_D |
+            (stream.global ? PTE_G : PTE_U);
+        search.granularity = 0;
+
+        instret += instret_per_access;
+        emit(packet);
+    }
+    encoder.flush(os);
+    os.flush();
+
+    fprintf(stderr, "Generated:\n");
+    fprintf(stderr, "  Accesses: %ld\n", accesses * harts);
+    fprintf(stderr, "  Flushes : %ld\n", flushes);
+    return 0;
+}
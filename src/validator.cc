@@ -5,6 +5,8 @@
  * This file defines validators.
  */
 
+#include <cstdio>
+
 #include "stats.h"
 #include "validator.h"
 #include "config.h"
@@ -142,7 +144,8 @@ int TLBValidator::access(tlb_entry_t &search, const tlbsim_req_t& req) {
     tlb_entry_t dup = search;
 
     int perm;
-    if (find_and_lock(search)) {
+    bool hit = find(search);
+    if (hit) {
         perm = pte_permission_check(search.pte, req);
         if (perm <= 0 || !config_update_pte) goto hit;
     }
@@ -150,9 +153,9 @@ int TLBValidator::access(tlb_entry_t &search, const tlbsim_req_t& req) {
     ++stats->miss;
 
     perm = parent->access(search, req);
-    if (!config_cache_inv && perm != 0) goto unlock;
+    if (!config_cache_inv && perm != 0) return perm;
 
-    insert_and_unlock(search);
+    if (insert(search) && !hit) ++stats->race;
     return perm;
 
 hit:
@@ -191,8 +194,6 @@ hit:
         }
     }
 
-unlock:
-    unlock(search);
     return perm;
 }
 
@@ -0,0 +1,98 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ * Copyright (c) 2019, Gary Guo
+ */
+
+#include "walk_cache.h"
+#include "util.h"
+
+namespace tlbsim {
+
+WalkCache* config_pwcs[MAX_HARTS];
+
+WalkCache::cache_t::cache_t(tlb_stats_t* stats, int size, int assoc):
+    stats{stats}, idx_bits{ilog2(size / assoc)}, assoc{assoc}, entries(size), ptrs(size / assoc) {}
+
+WalkCache::entry_t* WalkCache::cache_t::set(uint64_t tag) {
+    size_t index = ((tag >> 2) ^ (tag & 3)) & ((1ULL << idx_bits) - 1);
+    return &entries[index * assoc];
+}
+
+WalkCache::WalkCache(const std::vector<tlb_stats_t*>& stats, int size, int assoc) {
+    for (auto stat: stats) caches.emplace_back(stat, size, assoc);
+}
+
+// The cache is private, so realms (which tell harts apart in shared TLBs) are ignored.
+int WalkCache::find(asid_t& asid, uint64_t root, uint64_t vpn, int levels, uint64_t& pte) {
+    asid_t key = asid;
+    key.realm(0);
+    for (int level = 1; level < levels; level++) {
+        auto& cache = this->cache(level);
+        uint64_t tag = make_tag(vpn, level);
+        entry_t* set = cache.set(tag);
+        for (int i = 0; i < cache.assoc; i++) {
+            auto& entry = set[i];
+            if (entry.tag != tag || entry.root != root || !entry.asid.match(key)) continue;
+            pte = entry.pte;
+            if (entry.asid.global()) asid.global(true);
+            return level;
+        }
+    }
+    return 0;
+}
+
+void WalkCache::insert(asid_t asid, uint64_t root, uint64_t vpn, int level, uint64_t pte) {
+    auto& cache = this->cache(level);
+    ++cache.stats->miss;
+    uint64_t tag = make_tag(vpn, level);
+    entry_t* set = cache.set(tag);
+    int& ptr = cache.ptrs[(set - cache.entries.data()) / cache.assoc];
+
+    // Use an invalid way if there is one, otherwise evict the way pointed by the FIFO pointer.
+    int way = ptr;
+    for (int i = 0; i < cache.assoc; i++) {
+        if (!set[i].tag) {
+            way = i;
+            break;
+        }
+    }
+    if (way == ptr) ptr = ptr == cache.assoc - 1 ? 0 : ptr + 1;
+
+    auto& entry = set[way];
+    if (entry.tag) ++cache.stats->evict;
+    entry.tag = tag;
+    entry.root = root;
+    entry.pte = pte;
+    entry.asid = asid;
+    entry.asid.realm(0);
+}
+
+void WalkCache::flush(asid_t asid, uint64_t vpn) {
+    asid.realm(0);
+    for (int i = 0; i < (int)caches.size(); i++) {
+        auto& cache = caches[i];
+        uint64_t num_flush = 0;
+        auto flush_entry = [&](entry_t& entry) {
+            if (!entry.tag || !entry.asid.match_flush(asid)) return;
+            entry.tag = 0;
+            num_flush++;
+        };
+        if (vpn == 0) {
+            for (auto& entry: cache.entries) flush_entry(entry);
+        } else {
+            // A unified cache holds all levels, otherwise only the level of the cache.
+            int first = caches.size() == 1 ? 1 : i + 1;
+            int last = caches.size() == 1 ? MAX_LEVEL : i + 1;
+            for (int level = first; level <= last; level++) {
+                uint64_t tag = make_tag(vpn, level);
+                entry_t* set = cache.set(tag);
+                for (int j = 0; j < cache.assoc; j++) {
+                    if (set[j].tag == tag) flush_entry(set[j]);
+                }
+            }
+        }
+        cache.stats->flush += num_flush;
+    }
+}
+
+}
@@ -12,6 +12,7 @@
 #include "config.h"
 #include "util.h"
 #include "stats.h"
+#include "walk_cache.h"
 
 namespace tlbsim {
 
@@ -42,6 +43,49 @@ int pte_permission_check(int pte, const tlbsim_req_t& req) {
 
 PageWalker page_walker;
 
+// Host pointers of recently walked page table pages, per hart. Pages which are not RAM are cached
+// as well, with a null pointer.
+struct alignas(64) phys_map_cache_t {
+    static constexpr int SIZE = 64;
+    struct {
+        // PPN plus 1, so zero-initialised entries are empty.
+        uint64_t tag;
+        uint64_t* page;
+    } entries[SIZE];
+
+    uint64_t* lookup(uint64_t ppn) {
+        auto& entry = entries[ppn % SIZE];
+        if (entry.tag != ppn + 1) {
+            entry.page = static_cast<uint64_t*>(tlbsim_client.phys_map(&tlbsim_client, ppn));
+            entry.tag = ppn + 1;
+        }
+        return entry.page;
+    }
+};
+
+static phys_map_cache_t phys_maps[MAX_HARTS];
+
+// Load the index-th PTE of the page table at ppn.
+static uint64_t load_pte(uint64_t ppn, uint64_t index) {
+    if (tlbsim_client.phys_map) {
+        uint64_t* page = phys_maps[current_hart].lookup(ppn);
+        if (page) return __atomic_load_n(&page[index], __ATOMIC_RELAXED);
+    }
+    return tlbsim_client.phys_load(&tlbsim_client, (ppn << 12) + index * 8);
+}
+
+static bool cmpxchg_pte(uint64_t ppn, uint64_t index, uint64_t old, uint64_t value) {
+    if (tlbsim_client.phys_map) {
+        uint64_t* page = phys_maps[current_hart].lookup(ppn);
+        if (page) {
+            return __atomic_compare_exchange_n(
+                &page[index], &old, value, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED
+            );
+        }
+    }
+    return tlbsim_client.phys_cmpxchg(&tlbsim_client, (ppn << 12) + index * 8, old, value);
+}
+
 int PageWalker::access(tlb_entry_t& search, const tlbsim_req_t& req) {
     // Find out levels in total
     int levels;
@@ -61,13 +105,29 @@ int PageWalker::access(tlb_entry_t& search, const tlbsim_req_t& req) {
         return -2;
     }
 
-    uint64_t ppn = req.satp & SATP_PPN;
+    uint64_t root = req.satp & SATP_PPN;
+    uint64_t ppn = root;
+    int first = 0;
+    ++walks;
+
+    // Start from the lowest non-leaf PTE in the page walk cache, if there is one.
+    WalkCache* pwc = config_pwcs[req.hartid];
+    if (pwc) {
+        uint64_t pte;
+        int level = pwc->find(search.asid, root, vpn, levels, pte);
+        if (level) {
+            ppn = pte >> 10;
+            first = levels - level;
+            walk_saved += first;
+        }
+    }
 
-    for (int i = 0, bits_left = vpn_bits - 9; i < levels; i++, bits_left -= 9) {
+    for (int i = first, bits_left = vpn_bits - 9 * (first + 1); i < levels; i++, bits_left -= 9) {
         uint64_t index = (vpn >> bits_left) & 0x1ff;
-        uint64_t pte_addr = (ppn << 12) + index * 8;
-        uint64_t pte = tlbsim_client.phys_load(&tlbsim_client, pte_addr);
+        uint64_t table = ppn;
+        uint64_t pte = load_pte(table, index);
         ppn = pte >> 10;
+        ++walk_loads;
 
         // Check for invalid PTE
         if (!(pte & PTE_V)) goto invalid;
@@ -80,7 +140,10 @@ int PageWalker::access(tlb_entry_t& search, const tlbsim_req_t& req) {
         if ((pte & PTE_G)) search.asid.global(true);
 
         // Not leaf yet
-        if (!(pte & (PTE_R | PTE_W | PTE_X))) continue;
+        if (!(pte & (PTE_R | PTE_W | PTE_X))) {
+            if (pwc && bits_left) pwc->insert(search.asid, root, vpn, bits_left / 9, pte);
+            continue;
+        }
 
         // Check for misaligned huge page
         if (ppn & ((1ULL << bits_left) - 1)) goto invalid;
@@ -88,7 +151,7 @@ int PageWalker::access(tlb_entry_t& search, const tlbsim_req_t& req) {
         int perm = pte_permission_check(pte, req);
         if (config_update_pte && perm > 0) {
             uint64_t updated_pte = pte | perm;
-            if (tlbsim_client.phys_cmpxchg(&tlbsim_client, pte_addr, pte, updated_pte)) {
+            if (cmpxchg_pte(table, index, pte, updated_pte)) {
                 pte = updated_pte;
             }
         }
@@ -103,6 +166,7 @@ int PageWalker::access(tlb_entry_t& search, const tlbsim_req_t& req) {
 invalid:
     search.ppn = 0;
     search.pte = 0;
+    search.granularity = 0;
     return pte_permission_check(0, req);
 }
 